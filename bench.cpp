@@ -0,0 +1,183 @@
+/*
+    Headless benchmark for the rasterizer library
+    Renders a few fixed scenes into an offscreen Screen (no SDL, no window) and prints the
+    average time per frame of each. The same scenes are used to train the profile-guided build
+    (make pgo), so they should stay close to what the rasterizer is really used for.
+
+    Usage: ./bench [frames] [scene]
+        frames: how many frames to render per scene (default 50)
+        scene: only run the scene with this name
+*/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include "rasterizer.h"
+using namespace std;
+using namespace rast;
+
+const int BENCH_WIDTH = 1280;
+const int BENCH_HEIGHT = 720;
+
+// Small random number generator so every run draws exactly the same triangles
+Uint32 benchSeed = 1;
+
+int benchRandom(int low, int high) {
+    benchSeed = benchSeed * 1103515245 + 12345;
+    return low + (int)((benchSeed >> 8) % (Uint32)(high - low + 1));
+}
+
+Uint32 benchColor() {
+    return ((Uint32)benchRandom(0, 255) << 24) | ((Uint32)benchRandom(0, 255) << 16) |
+           ((Uint32)benchRandom(0, 255) << 8) | 0xFF;
+}
+
+vector<vector<Vertex>> randomTriangles(int count, int maxSize) {
+    vector<vector<Vertex>> triangles;
+    for (int i = 0; i < count; i++) {
+        int cx = benchRandom(0, BENCH_WIDTH);
+        int cy = benchRandom(0, BENCH_HEIGHT);
+        vector<Vertex> triangle;
+        for (int v = 0; v < 3; v++) {
+            Vertex vertex = {cx + benchRandom(-maxSize, maxSize), cy + benchRandom(-maxSize, maxSize), benchColor(), 0};
+            triangle.push_back(vertex);
+        }
+        triangles.push_back(triangle);
+    }
+    return triangles;
+}
+
+// UV sphere with rings x segments quads, every vertex gets a random color
+Mesh sphereMesh(int rings, int segments) {
+    Mesh mesh;
+    for (int r = 0; r <= rings; r++) {
+        float phi = 3.14159265f * r / rings;
+        for (int s = 0; s <= segments; s++) {
+            float theta = 2 * 3.14159265f * s / segments;
+            Vec3 p = {sinf(phi) * cosf(theta), cosf(phi), sinf(phi) * sinf(theta)};
+            mesh.positions.push_back(p);
+            mesh.colors.push_back(benchColor());
+        }
+    }
+    for (int r = 0; r < rings; r++) {
+        for (int s = 0; s < segments; s++) {
+            int i0 = r * (segments + 1) + s;
+            int i1 = i0 + segments + 1;
+            int quad[6] = {i0, i1, i0 + 1, i0 + 1, i1, i1 + 1};
+            mesh.indices.insert(mesh.indices.end(), quad, quad + 6);
+        }
+    }
+    computeMeshBounds(mesh);
+    return mesh;
+}
+
+void clearPixels(Screen& screen) {
+    rasterKernels().fillRow(screen.pixels, screen.width * screen.height, 0x000000FF);
+}
+
+/*
+    Runs one scene and prints its average frame time
+    render(frame) draws frame number "frame" into the screen
+    clear: clear the screen before every frame (false for scenes that read what is already there)
+*/
+void runScene(const string& name, const string& only, int frames, Screen& screen, bool clear,
+              const function<void(int)>& render) {
+    if (!only.empty() && only != name) {
+        return;
+    }
+
+    // Warm up once so first-time setup (frame arena blocks, parallelRows() worker threads) isn't measured
+    if (clear) clearPixels(screen);
+    render(0);
+    resetFrameArena();
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int frame = 0; frame < frames; frame++) {
+        if (clear) clearPixels(screen);
+        render(frame);
+        resetFrameArena();
+    }
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    cout << name << ": " << ms / frames << " ms/frame" << endl;
+}
+
+int main(int argc, char** argv) {
+    int frames = (argc > 1) ? atoi(argv[1]) : 50;
+    string only = (argc > 2) ? argv[2] : "";
+    if (frames <= 0) {
+        cout << "Usage: " << argv[0] << " [frames] [scene]" << endl;
+        return 1;
+    }
+
+    // Which CPU-specific kernels are used (RAST_ISA=sse2/avx2/avx512 to compare them)
+    cout << "kernels: " << rasterKernels().name << endl;
+
+    Screen screen = createOffscreen(BENCH_WIDTH, BENCH_HEIGHT);
+
+    // Scene 1: lots of small and medium triangles, the common case
+    vector<vector<Vertex>> small = randomTriangles(5000, 40);
+    runScene("triangles", only, frames, screen, true, [&](int) {
+        for (const auto& t : small) fillTriangle(screen, t[0], t[1], t[2]);
+    });
+
+    // Scene 2: the same triangles with anti-aliased edges
+    runScene("antialiased", only, frames, screen, true, [&](int) {
+        for (const auto& t : small) fillTriangleAA(screen, t[0], t[1], t[2]);
+    });
+
+    // Scene 3: a few big triangles, mostly long spans
+    vector<vector<Vertex>> big = randomTriangles(200, 400);
+    runScene("large", only, frames, screen, true, [&](int) {
+        for (const auto& t : big) fillTriangle(screen, t[0], t[1], t[2]);
+    });
+
+    // Scene 4: the big triangles with gamma-correct colors
+    runScene("linear", only, frames, screen, true, [&](int) {
+        screen.linearColor = true;
+        for (const auto& t : big) fillTriangle(screen, t[0], t[1], t[2]);
+        screen.linearColor = false;
+    });
+
+    // Scene 5: 2x2 supersampling
+    vector<vector<Vertex>> few(big.begin(), big.begin() + 50);
+    runScene("supersampled", only, frames, screen, true, [&](int) {
+        renderSupersampled(screen, few, 2);
+    });
+
+    // Scene 6: a 3D scene with frustum culling, the camera turns a bit every frame
+    Mesh sphere = sphereMesh(16, 24);
+    vector<SceneObject> objects;
+    for (int x = -10; x <= 10; x++) {
+        for (int z = -10; z <= 10; z++) {
+            SceneObject object;
+            object.mesh = &sphere;
+            object.model = translationMatrix(x * 3.0f, 0, z * 3.0f);
+            object.lod = NULL;
+            updateObjectBounds(object);
+            objects.push_back(object);
+        }
+    }
+    SceneBVH bvh = buildSceneBVH(objects);
+    Mat4 projection = perspectiveMatrix(1.0f, (float)BENCH_WIDTH / BENCH_HEIGHT, 0.1f, 200.0f);
+    runScene("scene3d", only, frames, screen, true, [&](int frame) {
+        float angle = frame * 0.05f;
+        Vec3 eye = {sinf(angle) * 20, 8, cosf(angle) * 20};
+        Vec3 target = {0, 0, 0};
+        Vec3 up = {0, 1, 0};
+        drawScene(screen, objects, bvh, multiply(projection, lookAtMatrix(eye, target, up)));
+    });
+
+    // Scene 7: converting the finished frame to RGB565 with dithering
+    Framebuffer<FormatRGB565> rgb565 = createFramebuffer<FormatRGB565>(BENCH_WIDTH, BENCH_HEIGHT);
+    for (const auto& t : big) fillTriangle(screen, t[0], t[1], t[2]);
+    runScene("convert", only, frames, screen, false, [&](int) {
+        convertScreenDithered(screen, rgb565, DITHER_BAYER);
+    });
+
+    destroyOffscreen(screen);
+    return 0;
+}
@@ -0,0 +1,3618 @@
+/*
+    Rasterizer core (see rasterizer.h)
+*/
+#include "rasterizer.h"
+using namespace std;
+
+namespace rast {
+
+// Fill the whole stencil buffer with one value
+void clearStencil(Screen& screen, Uint8 value) {
+    for (int i = 0; i < screen.width * screen.height; i++) {
+        screen.stencil[i] = value;
+    }
+}
+
+// Full-screen viewport, no scissor, no stencil test, plain (sRGB) color interpolation
+void resetRenderState(Screen& screen) {
+    screen.viewport.x = 0;
+    screen.viewport.y = 0;
+    screen.viewport.width = screen.width;
+    screen.viewport.height = screen.height;
+
+    screen.scissorEnabled = false;
+    screen.scissor = screen.viewport;
+
+    screen.stencilState.enabled = false;
+    screen.stencilState.func = STENCIL_ALWAYS;
+    screen.stencilState.ref = 0;
+    screen.stencilState.passOp = STENCIL_KEEP;
+    screen.stencilState.writeColor = true;
+
+    screen.linearColor = false;
+}
+
+// Set a single pixel (with bounds checking)
+void setPixel(Screen& screen, int x, int y, Uint32 color) {
+    if (x < 0 || x >= screen.width || y < 0 || y >= screen.height) {
+        return;
+    }
+    int index = y * screen.width + x;
+    screen.pixels[index] = color;
+}
+
+/*
+    The rectangle of pixels that drawing is allowed to touch:
+    the screen, cut down to the viewport, cut down to the scissor (if enabled)
+    Triangles clamp their rows and spans to this once, instead of checking every pixel.
+    Width or height is 0 if nothing can be drawn.
+*/
+ClipRect clipRect(const Screen& screen) {
+    int left = max(0, screen.viewport.x);
+    int top = max(0, screen.viewport.y);
+    int right = min(screen.width, screen.viewport.x + screen.viewport.width);     // exclusive
+    int bottom = min(screen.height, screen.viewport.y + screen.viewport.height);  // exclusive
+
+    if (screen.scissorEnabled) {
+        left = max(left, screen.scissor.x);
+        top = max(top, screen.scissor.y);
+        right = min(right, screen.scissor.x + screen.scissor.width);
+        bottom = min(bottom, screen.scissor.y + screen.scissor.height);
+    }
+
+    ClipRect clip = {left, top, max(0, right - left), max(0, bottom - top)};
+    return clip;
+}
+
+/*
+    Runs the stencil test for one pixel and updates the stencil buffer if it passes
+    Returns true if the pixel's color should be written.
+
+    Example: clipping to nested UI panels (stencil cleared to 0)
+        1. Draw the outer panel with func = EQUAL, ref = 0, passOp = INCREMENT, writeColor = false
+           -> pixels inside the outer panel become 1
+        2. Draw the inner panel with func = EQUAL, ref = 1, passOp = INCREMENT, writeColor = false
+           -> pixels inside both panels become 2
+        3. Draw the contents with func = EQUAL, ref = 2, passOp = KEEP, writeColor = true
+           -> only pixels inside both panels are drawn
+*/
+bool stencilPass(Screen& screen, int index) {
+    const StencilState& state = screen.stencilState;
+    if (!state.enabled) return true;
+
+    Uint8& value = screen.stencil[index];
+    bool pass;
+    switch (state.func) {
+        case STENCIL_EQUAL:         pass = (value == state.ref); break;
+        case STENCIL_NOT_EQUAL:     pass = (value != state.ref); break;
+        case STENCIL_GREATER_EQUAL: pass = (value >= state.ref); break;
+        default:                    pass = true; break;
+    }
+    if (!pass) return false;
+
+    switch (state.passOp) {
+        case STENCIL_ZERO:      value = 0; break;
+        case STENCIL_REPLACE:   value = state.ref; break;
+        case STENCIL_INCREMENT: if (value < 255) value++; break;
+        case STENCIL_DECREMENT: if (value > 0) value--; break;
+        default: break;
+    }
+    return state.writeColor;
+}
+
+/*
+    Worker threads for parallelRows(), started the first time it's called and then kept waiting
+    for the next call, so a frame doesn't pay for starting and joining threads every time.
+    A call hands out its bands one at a time under the lock; the workers and the calling thread
+    each take the next band until there are none left.
+    stopRowWorkers() (or the end of the program) tells the workers to return and joins them.
+*/
+struct RowWorkers {
+    vector<thread> threads;
+    mutex callLock;                 // one parallelRows() call (or stopRowWorkers()) at a time
+    mutex lock;                     // guards everything below
+    condition_variable wake;        // a call has bands to hand out, or the workers should stop
+    condition_variable finished;    // the last band of a call is done
+    const function<void(int, int)>* work = NULL;
+    int height = 0;
+    int bandHeight = 0;
+    int nextBand = 0;
+    int numBands = 0;
+    int unfinished = 0;
+    bool stopping = false;
+    exception_ptr error;            // first exception a band threw, rethrown by parallelRows()
+
+    ~RowWorkers();
+};
+
+thread_local bool IN_PARALLEL_ROWS = false; // this thread is already running a band
+
+// Takes bands until there are none left, lock must be held (it's released while a band runs)
+void runBands(RowWorkers& workers, unique_lock<mutex>& lock, bool workerThread) {
+    while (workers.nextBand < workers.numBands) {
+        int yStart = workers.nextBand * workers.bandHeight;
+        int yEnd = min(yStart + workers.bandHeight, workers.height);
+        workers.nextBand++;
+        const function<void(int, int)>& work = *workers.work;
+        lock.unlock();
+        exception_ptr error;
+        try {
+            if (workerThread) {
+                // A worker's frame arena is never reset, so whatever the band allocates goes back right away
+                FrameArenaScope arenaScope;
+                work(yStart, yEnd);
+            } else {
+                work(yStart, yEnd);
+            }
+        } catch (...) {
+            error = current_exception();
+        }
+        lock.lock();
+        if (error && !workers.error) workers.error = error;
+        if (--workers.unfinished == 0) workers.finished.notify_all();
+    }
+}
+
+void rowWorkerLoop(RowWorkers* workers) {
+    IN_PARALLEL_ROWS = true;
+    unique_lock<mutex> lock(workers->lock);
+    while (true) {
+        workers->wake.wait(lock, [&] { return workers->stopping || workers->nextBand < workers->numBands; });
+        if (workers->stopping) return;
+        runBands(*workers, lock, true);
+    }
+}
+
+// Destroyed at the end of the program, which stops the workers
+RowWorkers& rowWorkers() {
+    static RowWorkers workers;
+    return workers;
+}
+
+// Tells the workers to return and joins them (waits for a parallelRows() call that is still running)
+void stopWorkers(RowWorkers& workers) {
+    lock_guard<mutex> call(workers.callLock);
+    {
+        lock_guard<mutex> lock(workers.lock);
+        workers.stopping = true;
+    }
+    workers.wake.notify_all();
+    for (thread& worker : workers.threads) worker.join();
+    workers.threads.clear();
+    workers.stopping = false;
+}
+
+/*
+    Stops the worker threads and waits for them to exit. They are started again by the next
+    parallelRows() call. Programs that unload the library (e.g. through the C API) should call it
+    first. Must not be called from inside parallelRows() work.
+*/
+void stopRowWorkers() {
+    stopWorkers(rowWorkers());
+}
+
+RowWorkers::~RowWorkers() {
+    stopWorkers(*this);
+}
+
+/*
+    Splits the rows [0, height) into bands and runs work(yStart, yEnd) on the bands in parallel,
+    on the calling thread and the worker threads (see RowWorkers), and returns when all are done.
+    Every band writes to different rows, so the threads never touch the same pixels.
+    Called again from inside a band, it just runs the work on the current thread.
+    If a band throws, the other bands still finish and the exception is rethrown here.
+*/
+void parallelRows(int height, const function<void(int, int)>& work) {
+    int numThreads = (int)thread::hardware_concurrency();
+    if (numThreads < 1) numThreads = 1;
+    if (numThreads > height) numThreads = height;
+
+    // Not worth waking the workers for a single band
+    if (numThreads <= 1 || IN_PARALLEL_ROWS) {
+        if (height > 0) work(0, height);
+        return;
+    }
+
+    RowWorkers& workers = rowWorkers();
+    lock_guard<mutex> call(workers.callLock);
+    if (workers.threads.empty()) {
+        // One worker per core besides the calling thread
+        int cores = (int)thread::hardware_concurrency();
+        for (int i = 1; i < cores; i++) workers.threads.push_back(thread(rowWorkerLoop, &workers));
+    }
+    IN_PARALLEL_ROWS = true;
+    unique_lock<mutex> lock(workers.lock);
+    workers.work = &work;
+    workers.height = height;
+    workers.bandHeight = (height + numThreads - 1) / numThreads;
+    workers.nextBand = 0;
+    workers.numBands = (height + workers.bandHeight - 1) / workers.bandHeight;
+    workers.unfinished = workers.numBands;
+    workers.wake.notify_all();
+
+    // Help with the bands, then wait for the ones the workers are still drawing
+    runBands(workers, lock, false);
+    workers.finished.wait(lock, [&] { return workers.unfinished == 0; });
+    workers.work = NULL;
+    exception_ptr error = workers.error;
+    workers.error = NULL;
+    IN_PARALLEL_ROWS = false;
+    if (error) rethrow_exception(error);
+}
+
+// The calling thread's arena
+FrameArena& frameArena() {
+    static thread_local FrameArena arena = {vector<vector<char>>(), 0};
+    return arena;
+}
+
+void* arenaAllocate(FrameArena& arena, size_t bytes) {
+    bytes = (bytes + FRAME_ARENA_ALIGN - 1) & ~(FRAME_ARENA_ALIGN - 1);
+    if (arena.blocks.empty() || arena.offset + bytes > arena.blocks.back().size()) {
+        // Out of space: add a block (at least twice as big as the last one)
+        size_t size = arena.blocks.empty() ? FRAME_ARENA_BLOCK_SIZE : arena.blocks.back().size() * 2;
+        arena.blocks.push_back(vector<char>(max(size, bytes)));
+        arena.offset = 0;
+    }
+    void* result = arena.blocks.back().data() + arena.offset;
+    arena.offset += bytes;
+    return result;
+}
+
+// Frees everything the calling thread allocated from its arena (call once per frame)
+void resetFrameArena() {
+    FrameArena& arena = frameArena();
+    if (arena.blocks.size() > 1) {
+        size_t total = 0;
+        for (const vector<char>& block : arena.blocks) total += block.size();
+        arena.blocks.clear();
+        arena.blocks.push_back(vector<char>(total));
+    }
+    arena.offset = 0;
+}
+
+FrameArenaScope::FrameArenaScope() : arena(frameArena()), blocks(arena.blocks.size()), offset(arena.offset) {}
+
+FrameArenaScope::~FrameArenaScope() {
+    if (arena.blocks.size() == blocks) {
+        arena.offset = offset;
+    } else if (blocks <= 1 && offset == 0) {
+        // The arena was empty when the scope was opened, so this is a full reset
+        // (which also merges the blocks that were added into one)
+        resetFrameArena();
+    } else {
+        // Blocks were added, and something from before the scope is still in use: drop only the new ones
+        arena.blocks.resize(blocks);
+        arena.offset = offset;
+    }
+}
+
+/*
+    Helper function that interpolates between two colors
+    Used in bresenham functions
+*/
+Uint32 interpolateColor(Uint32 color0, Uint32 color1, float t) {
+    // Extract R, G, B, A from color0
+    uint8_t r1 = (color0 >> 24) & 0xFF;
+    uint8_t g1 = (color0 >> 16) & 0xFF;
+    uint8_t b1 = (color0 >> 8) & 0xFF;
+    uint8_t a1 = color0 & 0xFF;
+
+    // Extract R, G, B, A from color1
+    uint8_t r2 = (color1 >> 24) & 0xFF;
+    uint8_t g2 = (color1 >> 16) & 0xFF;
+    uint8_t b2 = (color1 >> 8) & 0xFF;
+    uint8_t a2 = color1 & 0xFF;
+
+    // Interpolate each component
+    uint8_t r = (uint8_t)(r1 + (r2 - r1) * t);
+    uint8_t g = (uint8_t)(g1 + (g2 - g1) * t);  
+    uint8_t b = (uint8_t)(b1 + (b2 - b1) * t);  
+    uint8_t a = (uint8_t)(a1 + (a2 - a1) * t);
+
+    // Pack into new color
+    Uint32 result = (r << 24) | (g << 16) | (b << 8) | a;
+    
+    return result;
+}
+
+SrgbTables buildSrgbTables() {
+    SrgbTables tables;
+    for (int i = 0; i < 256; i++) {
+        float srgb = i / 255.0f;
+        float linear = (srgb <= 0.04045f) ? srgb / 12.92f : pow((srgb + 0.055f) / 1.055f, 2.4f);
+        tables.toLinear[i] = (Uint16)(linear * 4095 + 0.5f);
+    }
+    for (int i = 0; i < 4096; i++) {
+        float linear = i / 4095.0f;
+        float srgb = (linear <= 0.0031308f) ? linear * 12.92f : 1.055f * pow(linear, 1 / 2.4f) - 0.055f;
+        tables.toSrgb[i] = (Uint8)(srgb * 255 + 0.5f);
+    }
+    return tables;
+}
+
+// Built the first time they're needed (C++11 makes sure that happens once, even with several threads)
+const SrgbTables& srgbTables() {
+    static const SrgbTables tables = buildSrgbTables();
+    return tables;
+}
+
+// Same as interpolateColor(), but mixes in linear light
+Uint32 interpolateColorLinear(Uint32 color0, Uint32 color1, float t) {
+    const SrgbTables& tables = srgbTables();
+    Uint32 result = 0;
+    for (int shift = 8; shift < 32; shift += 8) {
+        int linear0 = tables.toLinear[(color0 >> shift) & 0xFF];
+        int linear1 = tables.toLinear[(color1 >> shift) & 0xFF];
+        int linear = (int)(linear0 + (linear1 - linear0) * t + 0.5f);
+        result |= (Uint32)tables.toSrgb[linear] << shift;
+    }
+    int a0 = color0 & 0xFF;
+    int a1 = color1 & 0xFF;
+    result |= (Uint32)(Uint8)(a0 + (a1 - a0) * t);
+    return result;
+}
+
+/*
+    Bresenham's Line Algorithm - RETURNS pixels instead of drawing them
+    Based on Wikipedia: https://en.wikipedia.org/wiki/Bresenham%27s_line_algorithm
+*/
+
+// Helper for shallow lines - returns list of pixels
+FrameVector<Vertex> bresenhamLow(int x0, int y0, Uint32 color0, 
+                                 int x1, int y1, Uint32 color1) {
+    FrameVector<Vertex> pixels;
+    int dx = x1 - x0;
+    int dy = y1 - y0;
+    int yi = 1;
+    
+    if (dy < 0) {
+        yi = -1;
+        dy = -dy;
+    }
+    
+    int D = (2 * dy) - dx;
+    int y = y0;
+
+    int totalSteps = dx; // Total pixels along the line
+    int currentStep = 0; // Which pixel we're on
+    
+    for (int x = x0; x <= x1; x++) {
+        // Calculate t (0.0 at start, 1.0 at end)
+        float t = (totalSteps > 0) ? (float)currentStep / (float)totalSteps : 0.0f;
+
+        // Interpolate color for this pixel
+        Uint32 color = interpolateColor(color0, color1, t);
+
+        Vertex v = {x, y, color, 0.0f}; // Use interpolated color
+        pixels.push_back(v);
+
+        currentStep++; // Move to next pixel
+
+        if (D > 0) {
+            y = y + yi;
+            D = D + (2 * (dy - dx));
+        } else {
+            D = D + 2 * dy;
+        }
+    }
+    return pixels;
+}
+
+// Helper for steep lines - returns list of pixels
+FrameVector<Vertex> bresenhamHigh(int x0, int y0, Uint32 color0, 
+                                  int x1, int y1, Uint32 color1) {
+    FrameVector<Vertex> pixels;
+    int dx = x1 - x0;
+    int dy = y1 - y0;
+    int xi = 1;
+    
+    if (dx < 0) {
+        xi = -1;
+        dx = -dx;
+    }
+    
+    int D = (2 * dx) - dy;
+    int x = x0;
+
+    int totalSteps = dy; // Total pixels along the line
+    int currentStep = 0; // Which pixel we're on
+    
+    for (int y = y0; y <= y1; y++) {
+        // Calculate t (0.0 at start, 1.0 at end)
+        float t = (totalSteps > 0) ? (float)currentStep / (float)totalSteps : 0.0f;
+
+        // Interpolate color for this pixel
+        Uint32 color = interpolateColor(color0, color1, t);
+        
+        Vertex v = {x, y, color, 0.0f};  // Use interpolated color
+        pixels.push_back(v);
+
+        currentStep++;
+        
+        if (D > 0) {
+            x = x + xi;
+            D = D + (2 * (dx - dy));
+        } else {
+            D = D + 2 * dx;
+        }
+    }
+    return pixels;
+}
+
+// Main Bresenham - returns list of pixels on the line
+FrameVector<Vertex> bresenham(int x0, int y0, Uint32 color0, 
+                              int x1, int y1, Uint32 color1) {
+    if (abs(y1 - y0) < abs(x1 - x0)) {
+        if (x0 > x1) {
+            return bresenhamLow(x1, y1, color1, x0, y0, color0);
+        } else {
+            return bresenhamLow(x0, y0, color0, x1, y1, color1);
+        }
+    } else {
+        if (y0 > y1) {
+            return bresenhamHigh(x1, y1, color1, x0, y0, color0);
+        } else {
+            return bresenhamHigh(x0, y0, color0, x1, y1, color1);
+        }
+    }
+}
+
+// Draw triangle edges - collects pixels from all three edges
+// This function is deprecated (replaced with fillTriangle())
+void drawTriangle(Screen& screen, Vertex v0, Vertex v1, Vertex v2) {
+    FrameArenaScope arenaScope; // the scratch memory below is freed on return
+
+    // Step 1: Collect pixels from all three edges
+    FrameVector<Vertex> edge1 = bresenham(v0.x, v0.y, v0.color, v1.x, v1.y, v1.color);
+    FrameVector<Vertex> edge2 = bresenham(v1.x, v1.y, v1.color, v2.x, v2.y, v2.color);
+    FrameVector<Vertex> edge3 = bresenham(v2.x, v2.y, v2.color, v0.x, v0.y, v0.color);
+    
+    // Step 2: Draw all edge pixels
+    for (const Vertex& v : edge1) {
+        setPixel(screen, v.x, v.y, v.color);
+    }
+    for (const Vertex& v : edge2) {
+        setPixel(screen, v.x, v.y, v.color);
+    }
+    for (const Vertex& v : edge3) {
+        setPixel(screen, v.x, v.y, v.color);
+    }
+}
+
+/*
+    CPU-specific kernels (see RasterKernels in rasterizer.h)
+    Each kernel's loop is written once below as an always-inline function. Every instruction set gets
+    its own copy of the wrappers, marked with __attribute__((target(...))), and since the loop is
+    inlined into them it is compiled (and vectorized) for that instruction set.
+    The loops are kept simple on purpose: no calls, no branches on the pixel, plain arrays, so the
+    compiler can vectorize them. They use exactly the same math as the scalar code they replace,
+    so every set gives the same pixels.
+*/
+#define KERNEL_INLINE static inline __attribute__((always_inline))
+
+KERNEL_INLINE void fillRowLoop(Uint32* row, int count, Uint32 color) {
+    for (int i = 0; i < count; i++) {
+        row[i] = color;
+    }
+}
+
+// Same math as interpolateColor(), one channel at a time
+KERNEL_INLINE void gradientSpanLoop(Uint32* row, int x_first, int x_last, int x_left, int x_right,
+                                    Uint32 color_left, Uint32 color_right) {
+    int r1 = (color_left >> 24) & 0xFF, r2 = (color_right >> 24) & 0xFF;
+    int g1 = (color_left >> 16) & 0xFF, g2 = (color_right >> 16) & 0xFF;
+    int b1 = (color_left >> 8) & 0xFF, b2 = (color_right >> 8) & 0xFF;
+    int a1 = color_left & 0xFF, a2 = color_right & 0xFF;
+    float width = (float)(x_right - x_left);
+    for (int x = x_first; x <= x_last; x++) {
+        float t_span = (float)(x - x_left) / width;
+        Uint32 r = (Uint32)(int)(r1 + (r2 - r1) * t_span);
+        Uint32 g = (Uint32)(int)(g1 + (g2 - g1) * t_span);
+        Uint32 b = (Uint32)(int)(b1 + (b2 - b1) * t_span);
+        Uint32 a = (Uint32)(int)(a1 + (a2 - a1) * t_span);
+        row[x] = (r << 24) | (g << 16) | (b << 8) | a;
+    }
+}
+
+// Linear light: the ends are converted once, then every pixel only needs the toSrgb table
+KERNEL_INLINE void linearGradientSpanLoop(Uint32* row, int x_first, int x_last, int x_left, int x_right,
+                                          Uint32 color_left, Uint32 color_right) {
+    const SrgbTables& tables = srgbTables();
+    int left[3], delta[3];
+    for (int c = 0; c < 3; c++) {
+        int shift = 24 - c * 8;
+        left[c] = tables.toLinear[(color_left >> shift) & 0xFF];
+        delta[c] = tables.toLinear[(color_right >> shift) & 0xFF] - left[c];
+    }
+    int alpha_left = color_left & 0xFF;
+    int alpha_delta = (int)(color_right & 0xFF) - alpha_left;
+    float width = (float)(x_right - x_left);
+
+    // Table lookups can't be vectorized, so the math is done for a chunk of pixels first
+    // (that loop vectorizes), then a second loop only looks up and packs
+    const int CHUNK = 64;
+    int red[CHUNK], green[CHUNK], blue[CHUNK], alpha[CHUNK];
+    for (int start = x_first; start <= x_last; start += CHUNK) {
+        int count = min(CHUNK, x_last - start + 1);
+        for (int i = 0; i < count; i++) {
+            float t_span = (float)(start + i - x_left) / width;
+            red[i] = (int)(left[0] + delta[0] * t_span + 0.5f);
+            green[i] = (int)(left[1] + delta[1] * t_span + 0.5f);
+            blue[i] = (int)(left[2] + delta[2] * t_span + 0.5f);
+            alpha[i] = (Uint8)(alpha_left + alpha_delta * t_span);
+        }
+        for (int i = 0; i < count; i++) {
+            row[start + i] = ((Uint32)tables.toSrgb[red[i]] << 24) | ((Uint32)tables.toSrgb[green[i]] << 16)
+                           | ((Uint32)tables.toSrgb[blue[i]] << 8) | (Uint32)alpha[i];
+        }
+    }
+}
+
+// Same math as FormatRGB565::encodeDithered()
+KERNEL_INLINE Uint16 encodeRGB565Dithered(Uint32 color, Uint32 threshold) {
+    Uint32 r = (((color >> 24) & 0xFF) * 31 + threshold) / 255;
+    Uint32 g = (((color >> 16) & 0xFF) * 63 + threshold) / 255;
+    Uint32 b = (((color >> 8) & 0xFF) * 31 + threshold) / 255;
+    return (Uint16)((r << 11) | (g << 5) | b);
+}
+
+// mask + 1 (the dither pattern's width) must divide 16, true for both patterns in ditherRow()
+KERNEL_INLINE void convertToRGB565Loop(const Uint32* source, Uint16* destination, int width,
+                                       const Uint8* thresholds, int mask) {
+    if (!thresholds) {
+        for (int x = 0; x < width; x++) {
+            Uint32 color = source[x];
+            destination[x] = (Uint16)(((color >> 16) & 0xF800) | ((color >> 13) & 0x07E0) | ((color >> 11) & 0x001F));
+        }
+        return;
+    }
+
+    // thresholds[x & mask] is a lookup per pixel, which doesn't vectorize. Repeating the pattern
+    // to 16 pixels and going 16 pixels at a time turns it into a plain load.
+    Uint8 pattern[16];
+    for (int k = 0; k < 16; k++) pattern[k] = thresholds[k & mask];
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        for (int k = 0; k < 16; k++) {
+            destination[x + k] = encodeRGB565Dithered(source[x + k], pattern[k]);
+        }
+    }
+    for (; x < width; x++) {
+        destination[x] = encodeRGB565Dithered(source[x], pattern[x & 15]);
+    }
+}
+
+KERNEL_INLINE void evaluateEdgesLoop(const EdgeEquation* edges, int y, int x_first, int count,
+                                     float* d0, float* d1, float* d2) {
+    // Copied into locals so the compiler knows writing the results can't change them
+    float a0 = edges[0].a, b0 = edges[0].b, c0 = edges[0].c;
+    float a1 = edges[1].a, b1 = edges[1].b, c1 = edges[1].c;
+    float a2 = edges[2].a, b2 = edges[2].b, c2 = edges[2].c;
+    for (int i = 0; i < count; i++) {
+        int x = x_first + i;
+        d0[i] = a0 * x + b0 * y + c0;
+        d1[i] = a1 * x + b1 * y + c1;
+        d2[i] = a2 * x + b2 * y + c2;
+    }
+}
+
+// __builtin_popcountll is one instruction in the sets compiled with popcnt, a library call in the others
+KERNEL_INLINE Uint64 countBitsLoop(const Uint64* words, size_t count) {
+    Uint64 total = 0;
+    for (size_t i = 0; i < count; i++) total += __builtin_popcountll(words[i]);
+    return total;
+}
+
+KERNEL_INLINE Uint64 countCommonBitsLoop(const Uint64* a, const Uint64* b, size_t count) {
+    Uint64 total = 0;
+    for (size_t i = 0; i < count; i++) total += __builtin_popcountll(a[i] & b[i]);
+    return total;
+}
+
+/*
+    Stamps out one kernel set: wrappers compiled for TARGET, and the table that points at them
+    e.g. DEFINE_RASTER_KERNELS(AVX2, "avx2", KERNEL_TARGET("avx2")) defines KERNELS_AVX2
+*/
+#define DEFINE_RASTER_KERNELS(SUFFIX, NAME, TARGET)                                                      \
+    TARGET static void fillRow##SUFFIX(Uint32* row, int count, Uint32 color) {                           \
+        fillRowLoop(row, count, color);                                                                   \
+    }                                                                                                     \
+    TARGET static void gradientSpan##SUFFIX(Uint32* row, int x_first, int x_last, int x_left,            \
+                                            int x_right, Uint32 color_left, Uint32 color_right) {         \
+        gradientSpanLoop(row, x_first, x_last, x_left, x_right, color_left, color_right);                 \
+    }                                                                                                     \
+    TARGET static void linearGradientSpan##SUFFIX(Uint32* row, int x_first, int x_last, int x_left,      \
+                                                  int x_right, Uint32 color_left, Uint32 color_right) {   \
+        linearGradientSpanLoop(row, x_first, x_last, x_left, x_right, color_left, color_right);           \
+    }                                                                                                     \
+    TARGET static void convertToRGB565##SUFFIX(const Uint32* source, Uint16* destination, int width,     \
+                                               const Uint8* thresholds, int mask) {                       \
+        convertToRGB565Loop(source, destination, width, thresholds, mask);                                \
+    }                                                                                                     \
+    TARGET static void evaluateEdges##SUFFIX(const EdgeEquation* edges, int y, int x_first, int count,   \
+                                             float* d0, float* d1, float* d2) {                           \
+        evaluateEdgesLoop(edges, y, x_first, count, d0, d1, d2);                                          \
+    }                                                                                                     \
+    TARGET static Uint64 countBits##SUFFIX(const Uint64* words, size_t count) {                          \
+        return countBitsLoop(words, count);                                                               \
+    }                                                                                                     \
+    TARGET static Uint64 countCommonBits##SUFFIX(const Uint64* a, const Uint64* b, size_t count) {       \
+        return countCommonBitsLoop(a, b, count);                                                          \
+    }                                                                                                     \
+    const RasterKernels KERNELS_##SUFFIX = {NAME, fillRow##SUFFIX, gradientSpan##SUFFIX,                 \
+                                            linearGradientSpan##SUFFIX, convertToRGB565##SUFFIX,          \
+                                            evaluateEdges##SUFFIX, countBits##SUFFIX,                     \
+                                            countCommonBits##SUFFIX};
+
+/*
+    fp-contract=off: with FMA available (AVX-512, or any set in a -march=haswell build) the compiler
+    would fuse a * b + c into one instruction that rounds once instead of twice, and the wider sets
+    would give slightly different colors than the narrower ones
+*/
+#define KERNEL_TARGET(ISA) __attribute__((target(ISA), optimize("fp-contract=off")))
+
+// Every CPU with AVX2 also has popcnt, the SSE2 set has to run on older ones without it
+#if defined(__x86_64__) || defined(__i386__)
+DEFINE_RASTER_KERNELS(SSE2, "sse2", KERNEL_TARGET("sse2"))
+DEFINE_RASTER_KERNELS(AVX2, "avx2", KERNEL_TARGET("avx2,popcnt"))
+DEFINE_RASTER_KERNELS(AVX512, "avx512", KERNEL_TARGET("avx512f,avx512bw,popcnt"))
+#else
+DEFINE_RASTER_KERNELS(GENERIC, "generic", __attribute__((optimize("fp-contract=off"))))
+#endif
+
+// The kernel sets this CPU can run, narrowest first
+vector<const RasterKernels*> supportedRasterKernels() {
+    vector<const RasterKernels*> supported;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init(); // we may run before main(), so the CPU info may not be filled in yet
+    if (__builtin_cpu_supports("sse2")) supported.push_back(&KERNELS_SSE2);
+    bool popcnt = __builtin_cpu_supports("popcnt");
+    if (__builtin_cpu_supports("avx2") && popcnt) supported.push_back(&KERNELS_AVX2);
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") && popcnt) supported.push_back(&KERNELS_AVX512);
+    if (supported.empty()) {
+        // A 32-bit CPU without SSE2: the SSE2 set would crash, but it's still the only one we have
+        supported.push_back(&KERNELS_SSE2);
+    }
+#else
+    supported.push_back(&KERNELS_GENERIC);
+#endif
+    return supported;
+}
+
+// The set called name, or NULL if there's no such set or the CPU can't run it
+const RasterKernels* findRasterKernels(const char* name) {
+    vector<const RasterKernels*> supported = supportedRasterKernels();
+    for (const RasterKernels* kernels : supported) {
+        if (strcmp(kernels->name, name) == 0) return kernels;
+    }
+    return NULL;
+}
+
+/*
+    Picks the widest kernel set this CPU can run, or the one named in RAST_ISA
+    Asking for a set the CPU doesn't support falls back to the best one it does (running AVX-512
+    code on a CPU without it would crash), rasterKernels().name says which one that was.
+*/
+const RasterKernels* selectRasterKernels() {
+    vector<const RasterKernels*> supported = supportedRasterKernels();
+    const char* requested = getenv("RAST_ISA");
+    if (requested && requested[0]) {
+        const RasterKernels* kernels = findRasterKernels(requested);
+        if (kernels) return kernels;
+    }
+    return supported.back();
+}
+
+/*
+    The kernel set in use, picked the first time anything asks for it. A function-local static
+    instead of a global, so code that draws while other globals are being initialized still gets a set.
+*/
+const RasterKernels*& activeRasterKernels() {
+    static const RasterKernels* kernels = selectRasterKernels();
+    return kernels;
+}
+
+const RasterKernels& rasterKernels() {
+    return *activeRasterKernels();
+}
+
+void setRasterKernels(const RasterKernels& kernels) {
+    activeRasterKernels() = &kernels;
+}
+
+/*
+    Fills pixels x_first to x_last of row y with a color gradient
+    The gradient goes from color_left at x_left to color_right at x_right.
+    x_first and x_last may be inside x_left and x_right if the span was clipped.
+
+    The caller must have already clamped y, x_first and x_last to the clip rectangle,
+    so the pixels are written straight into the row without the bounds checks setPixel() does.
+    This is the innermost loop of the rasterizer, so every check we skip here counts.
+*/
+void fillSpan(Screen& screen, int y, int x_first, int x_last,
+              int x_left, int x_right, Uint32 color_left, Uint32 color_right) {
+    Uint32* row = screen.pixels + y * screen.width;
+
+    // Single pixel wide span, no gradient to interpolate
+    if (x_right == x_left) {
+        for (int x = x_first; x <= x_last; x++) {
+            if (stencilPass(screen, y * screen.width + x)) row[x] = color_left;
+        }
+        return;
+    }
+
+    if (screen.stencilState.enabled) {
+        // Slow path: every pixel has to pass the stencil test first
+        for (int x = x_first; x <= x_last; x++) {
+            if (!stencilPass(screen, y * screen.width + x)) continue;
+            float t_span = (float)(x - x_left) / (float)(x_right - x_left);
+            row[x] = mixColor(color_left, color_right, t_span, screen.linearColor);
+        }
+    } else if (screen.linearColor) {
+        rasterKernels().linearGradientSpan(row, x_first, x_last, x_left, x_right, color_left, color_right);
+    } else {
+        rasterKernels().gradientSpan(row, x_first, x_last, x_left, x_right, color_left, color_right);
+    }
+}
+
+TriangleEdge setupEdge(Vertex a, Vertex b) {
+    TriangleEdge edge;
+    edge.top = (a.y <= b.y) ? a : b;
+    edge.bottom = (a.y <= b.y) ? b : a;
+    edge.height = edge.bottom.y - edge.top.y;
+    return edge;
+}
+
+TriangleEdge setupEdge(const Screen& screen, Vertex a, Vertex b) {
+    // Vertex coordinates are relative to the viewport
+    a.x += screen.viewport.x; a.y += screen.viewport.y;
+    b.x += screen.viewport.x; b.y += screen.viewport.y;
+    return setupEdge(a, b);
+}
+
+/*
+    Where an edge crosses scanline y, and the color there
+    (y must be between edge.top.y and edge.bottom.y, and the edge must not be flat)
+*/
+void edgeAt(const TriangleEdge& edge, int y, float& x, Uint32& color, bool linear) {
+    float t = (float)(y - edge.top.y) / (float)edge.height;
+    x = edge.top.x + (edge.bottom.x - edge.top.x) * t;
+    color = mixColor(edge.top.color, edge.bottom.color, t, linear);
+}
+
+// Same as edgeAt(), for when only the position is needed
+float edgeX(const TriangleEdge& edge, int y) {
+    float t = (float)(y - edge.top.y) / (float)edge.height;
+    return edge.top.x + (edge.bottom.x - edge.top.x) * t;
+}
+
+/*
+    Works out which of a triangle's three edges is the long edge (v0 -> v2) and which are
+    the short edges of the top half (v0 -> v1) and bottom half (v1 -> v2), see fillTriangleEdges()
+*/
+void orderTriangleEdges(const TriangleEdge& e0, const TriangleEdge& e1, const TriangleEdge& e2,
+                        const TriangleEdge*& longEdge, const TriangleEdge*& topEdge, const TriangleEdge*& bottomEdge) {
+    longEdge = &e0;
+    const TriangleEdge* a = &e1;
+    const TriangleEdge* b = &e2;
+    if (e1.height > longEdge->height) { longEdge = &e1; a = &e0; b = &e2; }
+    if (e2.height > longEdge->height) { longEdge = &e2; a = &e0; b = &e1; }
+
+    bool aOnTop = (a->top.y < b->top.y) || (a->top.y == b->top.y && a->bottom.y <= b->bottom.y);
+    topEdge = aOnTop ? a : b;
+    bottomEdge = aOnTop ? b : a;
+}
+
+/*
+    The span of a triangle on scanline y: its left and right ends and the colors there
+    (edges come from orderTriangleEdges()). Returns false if the row is skipped (flat half).
+    linear: interpolate the colors in linear light
+*/
+bool triangleSpan(const TriangleEdge& longEdge, const TriangleEdge& topEdge, const TriangleEdge& bottomEdge,
+                  int y, int& x_left, int& x_right, Uint32& color_left, Uint32& color_right, bool linear) {
+    // Determine if we're in the top half or the bottom half of the triangle,
+    // and use the matching "short" edge (the middle vertex v1 is where the top edge ends)
+    const TriangleEdge& shortEdge = (y < topEdge.bottom.y) ? topEdge : bottomEdge;
+    if (shortEdge.height == 0) return false; // Skip if flat
+
+    // Calculate x positions and colors on both edges for this scanline
+    float x_long, x_short;
+    Uint32 color_long, color_short;
+    edgeAt(longEdge, y, x_long, color_long, linear);
+    edgeAt(shortEdge, y, x_short, color_short, linear);
+
+    // Make sure x_left is actually on the left
+    x_left = (int)min(x_long, x_short);
+    x_right = (int)max(x_long, x_short);
+    color_left = (x_long < x_short) ? color_long : color_short;
+    color_right = (x_long < x_short) ? color_short : color_long;
+    return true;
+}
+
+/*
+    Scanline fill of a triangle given its three (already set up) edges
+    The vertices are v0 (top), v1 (middle) and v2 (bottom), like in fillTriangle():
+        - The "long" edge goes from v0 to v2, so it is the tallest of the three
+        - The "short" edges are v0 -> v1 (top half) and v1 -> v2 (bottom half)
+    Of the two short edges, the top one is the one that starts higher up
+    (or, if they start on the same row, the one that ends higher up).
+*/
+void fillTriangleEdges(Screen& screen, const TriangleEdge& e0, const TriangleEdge& e1, const TriangleEdge& e2) {
+    // Step 1: Find the long edge and the two short edges
+    const TriangleEdge* longEdge;
+    const TriangleEdge* topEdge;
+    const TriangleEdge* bottomEdge;
+    orderTriangleEdges(e0, e1, e2, longEdge, topEdge, bottomEdge);
+
+    // Step 2: Handle degenerate case (flat line)
+    if (longEdge->height == 0) return;
+
+    // Only the rows and columns inside the clip rectangle (viewport + scissor) are drawn
+    ClipRect clip = clipRect(screen);
+    int clip_right = clip.x + clip.width - 1;
+    int y_first = max(longEdge->top.y, clip.y);
+    int y_last = min(longEdge->bottom.y, clip.y + clip.height - 1);
+
+    // Step 3: Scan from top to bottom
+    for (int y = y_first; y <= y_last; y++) {
+        int x_left, x_right;
+        Uint32 color_left, color_right;
+        if (!triangleSpan(*longEdge, *topEdge, *bottomEdge, y, x_left, x_right, color_left, color_right,
+                          screen.linearColor)) continue;
+
+        // Fill horizontal span from left to right
+        // (the span is cut to the clip rectangle first, colors still use the full span)
+        int x_first = max(x_left, clip.x);
+        int x_last = min(x_right, clip_right);
+        fillSpan(screen, y, x_first, x_last, x_left, x_right, color_left, color_right);
+    }
+}
+
+void fillTriangle(Screen& screen, Vertex v0, Vertex v1, Vertex v2) {
+    fillTriangleEdges(screen, setupEdge(screen, v0, v1), setupEdge(screen, v1, v2), setupEdge(screen, v2, v0));
+}
+
+// Helper function to check if the three vertices are collinear (on the same line)
+bool isCollinear(Vertex v0, Vertex v1, Vertex v2) {
+    // Calculate the area using cross product
+    // If area is 0, points are collinear
+    int area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+    return area == 0;
+}
+
+/*
+    Triangle strip: every new vertex makes a triangle with the two vertices before it
+        vertices: 0 1 2 3 4 ...
+        triangles: (0 1 2), (1 2 3), (2 3 4), ...
+    N triangles only need N + 2 vertices (instead of 3N for separate triangles),
+    and neighboring triangles share the edge between them:
+        triangle i uses edges (i, i+1), (i+1, i+2) and (i, i+2)
+        and (i+1, i+2) is also the first edge of triangle i + 1
+    So only 2 new edges are set up per triangle instead of 3.
+    Collinear (zero area) triangles are skipped, which is how strips are usually
+    joined or restarted (by repeating a vertex).
+*/
+void fillTriangleStrip(Screen& screen, const vector<Vertex>& vertices) {
+    if (vertices.size() < 3) return;
+
+    TriangleEdge shared = setupEdge(screen, vertices[0], vertices[1]);
+    for (size_t i = 0; i + 2 < vertices.size(); i++) {
+        TriangleEdge next = setupEdge(screen, vertices[i + 1], vertices[i + 2]);
+        if (!isCollinear(vertices[i], vertices[i + 1], vertices[i + 2])) {
+            TriangleEdge diagonal = setupEdge(screen, vertices[i], vertices[i + 2]);
+            fillTriangleEdges(screen, shared, next, diagonal);
+        }
+        shared = next;
+    }
+}
+
+/*
+    Triangle fan: every triangle shares the first vertex
+        vertices: 0 1 2 3 4 ...
+        triangles: (0 1 2), (0 2 3), (0 3 4), ...
+    Neighboring triangles share the edge from vertex 0 (0 -> i+1 is used by triangle i and i + 1),
+    so like strips only 2 new edges are set up per triangle.
+*/
+void fillTriangleFan(Screen& screen, const vector<Vertex>& vertices) {
+    if (vertices.size() < 3) return;
+
+    TriangleEdge shared = setupEdge(screen, vertices[0], vertices[1]);
+    for (size_t i = 1; i + 1 < vertices.size(); i++) {
+        TriangleEdge next = setupEdge(screen, vertices[0], vertices[i + 1]);
+        if (!isCollinear(vertices[0], vertices[i], vertices[i + 1])) {
+            TriangleEdge outer = setupEdge(screen, vertices[i], vertices[i + 1]);
+            fillTriangleEdges(screen, shared, outer, next);
+        }
+        shared = next;
+    }
+}
+
+/*
+    Fills a convex polygon (vertices in order around the outside, either direction)
+    A convex polygon can always be split into a fan around its first vertex,
+    so it is triangulated on the fly without building a list of triangles.
+*/
+void fillConvexPolygon(Screen& screen, const vector<Vertex>& vertices) {
+    fillTriangleFan(screen, vertices);
+}
+
+CoverageMask createCoverageMask(int width, int height) {
+    CoverageMask mask;
+    mask.width = width;
+    mask.height = height;
+    mask.wordsPerRow = (width + 63) / 64;
+    mask.bits.assign((size_t)mask.wordsPerRow * height, 0);
+    return mask;
+}
+
+void clearCoverageMask(CoverageMask& mask) {
+    fill(mask.bits.begin(), mask.bits.end(), 0);
+}
+
+// Bits first to last (inclusive, 0 to 63) of a word set to 1
+Uint64 bitRange(int first, int last) {
+    Uint64 upTo = (last == 63) ? ~0ULL : ((1ULL << (last + 1)) - 1);
+    return upTo & ~((1ULL << first) - 1);
+}
+
+// Sets pixels x_first to x_last of a row (already clamped to the mask's width)
+void setMaskSpan(Uint64* row, int x_first, int x_last) {
+    int firstWord = x_first / 64;
+    int lastWord = x_last / 64;
+    if (firstWord == lastWord) {
+        row[firstWord] |= bitRange(x_first % 64, x_last % 64);
+        return;
+    }
+    row[firstWord] |= bitRange(x_first % 64, 63);
+    for (int w = firstWord + 1; w < lastWord; w++) {
+        row[w] = ~0ULL; // 64 pixels in one write
+    }
+    row[lastWord] |= bitRange(0, x_last % 64);
+}
+
+/*
+    Marks the pixels covered by a triangle in the mask
+    This uses exactly the same edge setup and spans as fillTriangle(), so the mask matches
+    the pixels fillTriangle() would draw; it just skips all of the color work.
+*/
+void rasterizeCoverage(CoverageMask& mask, Vertex v0, Vertex v1, Vertex v2) {
+    TriangleEdge e0 = setupEdge(v0, v1);
+    TriangleEdge e1 = setupEdge(v1, v2);
+    TriangleEdge e2 = setupEdge(v2, v0);
+    const TriangleEdge* longEdge;
+    const TriangleEdge* topEdge;
+    const TriangleEdge* bottomEdge;
+    orderTriangleEdges(e0, e1, e2, longEdge, topEdge, bottomEdge);
+    if (longEdge->height == 0) return;
+
+    int middle_y = topEdge->bottom.y;
+    int y_first = max(longEdge->top.y, 0);
+    int y_last = min(longEdge->bottom.y, mask.height - 1);
+
+    for (int y = y_first; y <= y_last; y++) {
+        const TriangleEdge& shortEdge = (y < middle_y) ? *topEdge : *bottomEdge;
+        if (shortEdge.height == 0) continue;
+
+        float x_long = edgeX(*longEdge, y);
+        float x_short = edgeX(shortEdge, y);
+        int x_first = max((int)min(x_long, x_short), 0);
+        int x_last = min((int)max(x_long, x_short), mask.width - 1);
+        if (x_first > x_last) continue;
+
+        setMaskSpan(&mask.bits[(size_t)y * mask.wordsPerRow], x_first, x_last);
+    }
+}
+
+// Is pixel (x, y) covered? (false if it's outside the mask)
+bool maskTest(const CoverageMask& mask, int x, int y) {
+    if (x < 0 || x >= mask.width || y < 0 || y >= mask.height) {
+        return false;
+    }
+    return (mask.bits[(size_t)y * mask.wordsPerRow + x / 64] >> (x % 64)) & 1;
+}
+
+/*
+    Area queries count set bits with popcount, which counts a whole word (64 pixels) in one
+    instruction. A build for any x86-64 CPU can't use that instruction directly, so the counting
+    loops are kernels (rasterKernels().countBits()) and the AVX2/AVX-512 sets get popcnt.
+*/
+
+// Number of covered pixels in the whole mask
+Uint64 maskArea(const CoverageMask& mask) {
+    return rasterKernels().countBits(mask.bits.data(), mask.bits.size());
+}
+
+// Number of covered pixels inside a rectangle
+Uint64 maskArea(const CoverageMask& mask, ClipRect rect) {
+    int x_first = max(rect.x, 0);
+    int x_last = min(rect.x + rect.width, mask.width) - 1;
+    int y_first = max(rect.y, 0);
+    int y_last = min(rect.y + rect.height, mask.height) - 1;
+    if (x_first > x_last || y_first > y_last) return 0;
+
+    int firstWord = x_first / 64;
+    int lastWord = x_last / 64;
+    Uint64 firstBits = bitRange(x_first % 64, (firstWord == lastWord) ? x_last % 64 : 63);
+    Uint64 lastBits = bitRange(0, x_last % 64);
+
+    Uint64 area = 0;
+    for (int y = y_first; y <= y_last; y++) {
+        const Uint64* row = &mask.bits[(size_t)y * mask.wordsPerRow];
+
+        // The partly covered words at both ends, then the whole words between them
+        Uint64 ends[2] = {row[firstWord] & firstBits, (firstWord == lastWord) ? 0 : row[lastWord] & lastBits};
+        area += rasterKernels().countBits(ends, 2);
+        if (lastWord - firstWord > 1) {
+            area += rasterKernels().countBits(row + firstWord + 1, lastWord - firstWord - 1);
+        }
+    }
+    return area;
+}
+
+// Number of pixels covered in both masks (e.g. how much two collision masks overlap), masks must be the same size
+Uint64 maskOverlapArea(const CoverageMask& a, const CoverageMask& b) {
+    size_t words = min(a.bits.size(), b.bits.size());
+    return rasterKernels().countCommonBits(a.bits.data(), b.bits.data(), words);
+}
+
+VisibilityBuffer createVisibilityBuffer(int width, int height) {
+    VisibilityBuffer buffer;
+    buffer.width = width;
+    buffer.height = height;
+    buffer.ids.assign((size_t)width * height, VISIBILITY_EMPTY);
+    buffer.depth.assign((size_t)width * height, 1e30f);
+    return buffer;
+}
+
+void clearVisibilityBuffer(VisibilityBuffer& buffer) {
+    fill(buffer.ids.begin(), buffer.ids.end(), VISIBILITY_EMPTY);
+    fill(buffer.depth.begin(), buffer.depth.end(), 1e30f);
+}
+
+// Depth where an edge crosses scanline y (same interpolation as edgeAt())
+float edgeDepth(const TriangleEdge& edge, int y) {
+    float t = (float)(y - edge.top.y) / (float)edge.height;
+    return edge.top.z + (edge.bottom.z - edge.top.z) * t;
+}
+
+/*
+    Pass 1: writes a triangle's ID and depth into every pixel where it is the closest so far
+    Uses the same spans as fillTriangle(). A pixel is replaced if the new depth is less than or
+    equal to the stored one, so triangles at the same depth overlap in drawing order like fillTriangle().
+*/
+void rasterizeVisibility(VisibilityBuffer& buffer, Vertex v0, Vertex v1, Vertex v2, Uint32 id) {
+    TriangleEdge e0 = setupEdge(v0, v1);
+    TriangleEdge e1 = setupEdge(v1, v2);
+    TriangleEdge e2 = setupEdge(v2, v0);
+    const TriangleEdge* longEdge;
+    const TriangleEdge* topEdge;
+    const TriangleEdge* bottomEdge;
+    orderTriangleEdges(e0, e1, e2, longEdge, topEdge, bottomEdge);
+    if (longEdge->height == 0) return;
+
+    int y_first = max(longEdge->top.y, 0);
+    int y_last = min(longEdge->bottom.y, buffer.height - 1);
+
+    for (int y = y_first; y <= y_last; y++) {
+        const TriangleEdge& shortEdge = (y < topEdge->bottom.y) ? *topEdge : *bottomEdge;
+        if (shortEdge.height == 0) continue;
+
+        float x_long = edgeX(*longEdge, y);
+        float x_short = edgeX(shortEdge, y);
+        float z_long = edgeDepth(*longEdge, y);
+        float z_short = edgeDepth(shortEdge, y);
+
+        int x_left = (int)min(x_long, x_short);
+        int x_right = (int)max(x_long, x_short);
+        float z_left = (x_long < x_short) ? z_long : z_short;
+        float z_right = (x_long < x_short) ? z_short : z_long;
+        float z_step = (x_right == x_left) ? 0.0f : (z_right - z_left) / (x_right - x_left);
+
+        int x_first = max(x_left, 0);
+        int x_last = min(x_right, buffer.width - 1);
+        Uint32* ids = &buffer.ids[(size_t)y * buffer.width];
+        float* depth = &buffer.depth[(size_t)y * buffer.width];
+        for (int x = x_first; x <= x_last; x++) {
+            float z = z_left + z_step * (x - x_left);
+            if (z <= depth[x]) {
+                depth[x] = z;
+                ids[x] = id;
+            }
+        }
+    }
+}
+
+/*
+    Pass 2: colors every covered pixel from the triangle stored in it
+    The color is computed with the same edge and span interpolation as fillTriangle(), so the
+    result looks exactly like drawing the triangles in order (for triangles at the same depth).
+    Neighboring pixels usually belong to the same triangle, so the triangle's span for the row
+    is only recomputed when the ID changes. Rows are split into bands that are shaded in parallel.
+*/
+void shadeVisibility(Screen& screen, const VisibilityBuffer& buffer, const vector<vector<Vertex>>& triangles) {
+    int height = min(screen.height, buffer.height);
+    int width = min(screen.width, buffer.width);
+
+    parallelRows(height, [&](int yStart, int yEnd) {
+        for (int y = yStart; y < yEnd; y++) {
+            const Uint32* ids = &buffer.ids[(size_t)y * buffer.width];
+            Uint32* row = screen.pixels + y * screen.width;
+
+            Uint32 currentId = VISIBILITY_EMPTY;
+            int x_left = 0, x_right = 0;
+            Uint32 color_left = 0, color_right = 0;
+
+            for (int x = 0; x < width; x++) {
+                Uint32 id = ids[x];
+                if (id == VISIBILITY_EMPTY || id >= triangles.size()) continue;
+
+                if (id != currentId) {
+                    // Set up this triangle's span on this row
+                    const vector<Vertex>& triangle = triangles[id];
+                    TriangleEdge e0 = setupEdge(triangle[0], triangle[1]);
+                    TriangleEdge e1 = setupEdge(triangle[1], triangle[2]);
+                    TriangleEdge e2 = setupEdge(triangle[2], triangle[0]);
+                    const TriangleEdge* longEdge;
+                    const TriangleEdge* topEdge;
+                    const TriangleEdge* bottomEdge;
+                    orderTriangleEdges(e0, e1, e2, longEdge, topEdge, bottomEdge);
+                    if (!triangleSpan(*longEdge, *topEdge, *bottomEdge, y, x_left, x_right, color_left, color_right,
+                                      screen.linearColor)) {
+                        continue; // can't happen for IDs written by rasterizeVisibility()
+                    }
+                    currentId = id;
+                }
+
+                if (x_right == x_left) {
+                    row[x] = color_left;
+                } else {
+                    float t_span = (float)(x - x_left) / (float)(x_right - x_left);
+                    row[x] = mixColor(color_left, color_right, t_span, screen.linearColor);
+                }
+            }
+        }
+    });
+}
+
+OcclusionBuffer createOcclusionBuffer(int width, int height, int screenWidth, int screenHeight) {
+    OcclusionBuffer buffer;
+    buffer.width = width;
+    buffer.height = height;
+    buffer.scaleX = (float)width / screenWidth;
+    buffer.scaleY = (float)height / screenHeight;
+    buffer.depth.assign((size_t)width * height, 1e30f);
+    return buffer;
+}
+
+void clearOcclusionBuffer(OcclusionBuffer& buffer) {
+    fill(buffer.depth.begin(), buffer.depth.end(), 1e30f);
+}
+
+/*
+    Depth-only version of fillTriangle() for occluders (vertices in screen coordinates)
+    Same idea (sort the vertices, walk the long edge and the two short edges down the triangle),
+    but with no colors, no clip rectangle or stencil, and one depth per triangle.
+
+    Because the buffer is so much coarser than the screen, the vertices are scaled down to floats
+    instead of being rounded to whole pixels. A buffer pixel in row y covers y to y + 1, and the
+    triangle covers all of it only if it is inside the triangle's span at both the top (y) and
+    bottom (y + 1) of the row (a triangle is convex, so then it is also inside everywhere between).
+*/
+void rasterizeOccluder(OcclusionBuffer& buffer, Vertex v0, Vertex v1, Vertex v2) {
+    float farthest = max(v0.z, max(v1.z, v2.z));
+
+    // Step 1: Scale down to the buffer's resolution (screen pixel X covers X to X + 1)
+    float px[3] = {(v0.x + 0.5f) * buffer.scaleX, (v1.x + 0.5f) * buffer.scaleX, (v2.x + 0.5f) * buffer.scaleX};
+    float py[3] = {(v0.y + 0.5f) * buffer.scaleY, (v1.y + 0.5f) * buffer.scaleY, (v2.y + 0.5f) * buffer.scaleY};
+
+    // Step 2: Sort vertices by Y coordinate (top to bottom)
+    int order[3] = {0, 1, 2};
+    if (py[order[0]] > py[order[1]]) swap(order[0], order[1]);
+    if (py[order[0]] > py[order[2]]) swap(order[0], order[2]);
+    if (py[order[1]] > py[order[2]]) swap(order[1], order[2]);
+    float x0 = px[order[0]], y0 = py[order[0]];
+    float x1 = px[order[1]], y1 = py[order[1]];
+    float x2 = px[order[2]], y2 = py[order[2]];
+    if (y2 - y0 <= 0) return;
+
+    // Left and right ends of the triangle's span at height y (y must be between y0 and y2)
+    auto spanAt = [&](float y, float& left, float& right) {
+        float x_long = x0 + (x2 - x0) * (y - y0) / (y2 - y0);
+        float x_short;
+        if (y < y1) {
+            x_short = (y1 > y0) ? x0 + (x1 - x0) * (y - y0) / (y1 - y0) : x1;
+        } else {
+            x_short = (y2 > y1) ? x1 + (x2 - x1) * (y - y1) / (y2 - y1) : x1;
+        }
+        left = min(x_long, x_short);
+        right = max(x_long, x_short);
+    };
+
+    // Step 3: Only rows that are completely between the top and bottom vertices
+    int y_first = max((int)ceil(y0), 0);
+    int y_last = min((int)floor(y2) - 1, buffer.height - 1);
+
+    for (int y = y_first; y <= y_last; y++) {
+        float top_left, top_right, bottom_left, bottom_right;
+        spanAt((float)y, top_left, top_right);
+        spanAt((float)(y + 1), bottom_left, bottom_right);
+
+        // Pixels [x, x + 1] inside both spans
+        int x_first = max((int)ceil(max(top_left, bottom_left)), 0);
+        int x_last = min((int)floor(min(top_right, bottom_right)) - 1, buffer.width - 1);
+
+        float* row = &buffer.depth[(size_t)y * buffer.width];
+        for (int x = x_first; x <= x_last; x++) {
+            row[x] = min(row[x], farthest);
+        }
+    }
+}
+
+// True if the object is completely hidden behind the occluders (its draw can be skipped)
+bool isOccluded(const OcclusionBuffer& buffer, const ScreenBounds& bounds) {
+    // Grow the box outward to whole buffer pixels (screen pixel X covers X to X + 1)
+    int x_first = max((int)floor(bounds.minX * buffer.scaleX), 0);
+    int x_last = min((int)ceil((bounds.maxX + 1) * buffer.scaleX) - 1, buffer.width - 1);
+    int y_first = max((int)floor(bounds.minY * buffer.scaleY), 0);
+    int y_last = min((int)ceil((bounds.maxY + 1) * buffer.scaleY) - 1, buffer.height - 1);
+    if (x_first > x_last || y_first > y_last) return false; // off screen, not our job to cull
+
+    for (int y = y_first; y <= y_last; y++) {
+        const float* row = &buffer.depth[(size_t)y * buffer.width];
+        for (int x = x_first; x <= x_last; x++) {
+            if (row[x] >= bounds.minZ) return false; // nothing in front of the object here
+        }
+    }
+    return true;
+}
+
+// Screen bounds of a list of triangles (e.g. all of an object's triangles)
+ScreenBounds triangleBounds(const vector<vector<Vertex>>& triangles) {
+    ScreenBounds bounds = {INT_MAX, INT_MAX, INT_MIN, INT_MIN, 1e30f};
+    for (const auto& triangle : triangles) {
+        for (const Vertex& v : triangle) {
+            bounds.minX = min(bounds.minX, v.x);
+            bounds.minY = min(bounds.minY, v.y);
+            bounds.maxX = max(bounds.maxX, v.x);
+            bounds.maxY = max(bounds.maxY, v.y);
+            bounds.minZ = min(bounds.minZ, v.z);
+        }
+    }
+    return bounds;
+}
+
+PickIndex createPickIndex(int width, int height, int cellSize) {
+    cellSize = max(cellSize, 1); // 0 would divide by zero, a negative size would give a negative grid
+    PickIndex index;
+    index.width = width;
+    index.height = height;
+    index.cellSize = cellSize;
+    index.cols = (width + cellSize - 1) / cellSize;
+    index.rows = (height + cellSize - 1) / cellSize;
+    index.cells.resize((size_t)index.cols * index.rows);
+    return index;
+}
+
+/*
+    Point in triangle test, using the same cross product as isCollinear()
+    The point is inside if it is on the same side of all three edges (points on an edge count as inside).
+    The bounding box check first rejects far away points, and keeps collinear triangles
+    (where every point on the line is on "both sides") down to their line segment.
+*/
+bool pointInTriangle(Vertex v0, Vertex v1, Vertex v2, int x, int y) {
+    if (x < min(v0.x, min(v1.x, v2.x)) || x > max(v0.x, max(v1.x, v2.x))) return false;
+    if (y < min(v0.y, min(v1.y, v2.y)) || y > max(v0.y, max(v1.y, v2.y))) return false;
+
+    long long d0 = (long long)(v1.x - v0.x) * (y - v0.y) - (long long)(x - v0.x) * (v1.y - v0.y);
+    long long d1 = (long long)(v2.x - v1.x) * (y - v1.y) - (long long)(x - v1.x) * (v2.y - v1.y);
+    long long d2 = (long long)(v0.x - v2.x) * (y - v2.y) - (long long)(x - v2.x) * (v0.y - v2.y);
+    bool hasNegative = d0 < 0 || d1 < 0 || d2 < 0;
+    bool hasPositive = d0 > 0 || d1 > 0 || d2 > 0;
+    return !(hasNegative && hasPositive);
+}
+
+/*
+    Does a triangle overlap a rectangle? (separating axis test)
+    Two convex shapes don't overlap if there is a line between them. For a triangle and a rectangle,
+    the only lines that need to be checked are the rectangle's sides (the bounding boxes don't overlap)
+    and the triangle's edges (all 4 corners of the rectangle are outside the same edge).
+*/
+bool triangleOverlapsRect(const PickTriangle& t, ClipRect rect) {
+    int right = rect.x + rect.width - 1;
+    int bottom = rect.y + rect.height - 1;
+    if (t.maxX < rect.x || t.minX > right || t.maxY < rect.y || t.minY > bottom) return false;
+
+    long long area = (long long)(t.v[1].x - t.v[0].x) * (t.v[2].y - t.v[0].y)
+                   - (long long)(t.v[2].x - t.v[0].x) * (t.v[1].y - t.v[0].y);
+    if (area == 0) return true; // collinear: the bounding box test is as good as it gets
+
+    int cornersX[4] = {rect.x, right, rect.x, right};
+    int cornersY[4] = {rect.y, rect.y, bottom, bottom};
+    for (int e = 0; e < 3; e++) {
+        const Vertex& a = t.v[e];
+        const Vertex& b = t.v[(e + 1) % 3];
+        int outside = 0;
+        for (int c = 0; c < 4; c++) {
+            long long side = (long long)(b.x - a.x) * (cornersY[c] - a.y) - (long long)(cornersX[c] - a.x) * (b.y - a.y);
+            if ((area > 0) ? side < 0 : side > 0) outside++;
+        }
+        if (outside == 4) return false;
+    }
+    return true;
+}
+
+// Adds or removes a triangle's ID in every cell its bounding box overlaps
+void pickUpdateCells(PickIndex& index, Uint32 id, bool add) {
+    const PickTriangle& t = index.triangles[id];
+    int firstCol = max(t.minX / index.cellSize, 0);
+    int lastCol = min(t.maxX / index.cellSize, index.cols - 1);
+    int firstRow = max(t.minY / index.cellSize, 0);
+    int lastRow = min(t.maxY / index.cellSize, index.rows - 1);
+    if (t.maxX < 0 || t.maxY < 0) return; // completely off the top or left of the screen
+
+    for (int row = firstRow; row <= lastRow; row++) {
+        for (int col = firstCol; col <= lastCol; col++) {
+            vector<Uint32>& cell = index.cells[(size_t)row * index.cols + col];
+            if (add) {
+                cell.push_back(id);
+            } else {
+                // Order inside a cell doesn't matter, so swap with the last one and pop
+                for (size_t i = 0; i < cell.size(); i++) {
+                    if (cell[i] == id) {
+                        cell[i] = cell.back();
+                        cell.pop_back();
+                        break;
+                    }
+                }
+            }
+        }
+    }
+}
+
+void pickSetTriangle(PickTriangle& t, Vertex v0, Vertex v1, Vertex v2) {
+    t.v[0] = v0;
+    t.v[1] = v1;
+    t.v[2] = v2;
+    t.minX = min(v0.x, min(v1.x, v2.x));
+    t.maxX = max(v0.x, max(v1.x, v2.x));
+    t.minY = min(v0.y, min(v1.y, v2.y));
+    t.maxY = max(v0.y, max(v1.y, v2.y));
+}
+
+// Adds a triangle and returns its ID. Later triangles are treated as drawn on top of earlier ones.
+Uint32 pickAdd(PickIndex& index, Vertex v0, Vertex v1, Vertex v2) {
+    PickTriangle t;
+    pickSetTriangle(t, v0, v1, v2);
+    t.alive = true;
+    index.triangles.push_back(t);
+    Uint32 id = (Uint32)index.triangles.size() - 1;
+    pickUpdateCells(index, id, true);
+    return id;
+}
+
+// Moves a triangle, only touching the cells it used to overlap and the ones it overlaps now
+void pickUpdate(PickIndex& index, Uint32 id, Vertex v0, Vertex v1, Vertex v2) {
+    if (id >= index.triangles.size() || !index.triangles[id].alive) return;
+    pickUpdateCells(index, id, false);
+    pickSetTriangle(index.triangles[id], v0, v1, v2);
+    pickUpdateCells(index, id, true);
+}
+
+void pickRemove(PickIndex& index, Uint32 id) {
+    if (id >= index.triangles.size() || !index.triangles[id].alive) return;
+    pickUpdateCells(index, id, false);
+    index.triangles[id].alive = false;
+}
+
+// The topmost (most recently added) triangle containing (x, y), or PICK_NONE
+Uint32 pickPoint(const PickIndex& index, int x, int y) {
+    if (x < 0 || y < 0 || x >= index.width || y >= index.height) return PICK_NONE;
+    int col = x / index.cellSize;
+    int row = y / index.cellSize;
+
+    Uint32 best = PICK_NONE;
+    for (Uint32 id : index.cells[(size_t)row * index.cols + col]) {
+        if (best != PICK_NONE && id < best) continue; // can't be on top of what we found
+        const PickTriangle& t = index.triangles[id];
+        if (pointInTriangle(t.v[0], t.v[1], t.v[2], x, y)) best = id;
+    }
+    return best;
+}
+
+// IDs of every triangle overlapping a rectangle, in drawing order
+vector<Uint32> pickRect(const PickIndex& index, ClipRect rect) {
+    vector<Uint32> result;
+    if (rect.width <= 0 || rect.height <= 0) return result;
+    int firstCol = max(rect.x / index.cellSize, 0);
+    int lastCol = min((rect.x + rect.width - 1) / index.cellSize, index.cols - 1);
+    int firstRow = max(rect.y / index.cellSize, 0);
+    int lastRow = min((rect.y + rect.height - 1) / index.cellSize, index.rows - 1);
+
+    for (int row = firstRow; row <= lastRow; row++) {
+        for (int col = firstCol; col <= lastCol; col++) {
+            for (Uint32 id : index.cells[(size_t)row * index.cols + col]) {
+                if (triangleOverlapsRect(index.triangles[id], rect)) result.push_back(id);
+            }
+        }
+    }
+
+    // A triangle that spans several cells was found once per cell
+    sort(result.begin(), result.end());
+    result.erase(unique(result.begin(), result.end()), result.end());
+    return result;
+}
+
+/*
+    Sets up the three edge equations of a triangle
+    Edge i is the edge opposite vertex i, so E_i(v_i) is twice the triangle's area.
+    The equations are flipped if needed so the inside is always positive, no matter
+    which order (clockwise or counter-clockwise) the vertices were given in.
+    Returns twice the (positive) area, or 0 if the vertices are collinear.
+*/
+float setupEdgeEquations(Vertex v0, Vertex v1, Vertex v2, EdgeEquation edges[3]) {
+    Vertex p[3] = {v1, v2, v0}; // start of edge i
+    Vertex q[3] = {v2, v0, v1}; // end of edge i
+
+    for (int i = 0; i < 3; i++) {
+        edges[i].a = (float)(p[i].y - q[i].y);
+        edges[i].b = (float)(q[i].x - p[i].x);
+        edges[i].c = (float)p[i].x * q[i].y - (float)q[i].x * p[i].y;
+    }
+
+    // Same cross product as isCollinear()
+    float area = (float)(v1.x - v0.x) * (v2.y - v0.y) - (float)(v2.x - v0.x) * (v1.y - v0.y);
+    if (area < 0) {
+        for (int i = 0; i < 3; i++) {
+            edges[i].a = -edges[i].a;
+            edges[i].b = -edges[i].b;
+            edges[i].c = -edges[i].c;
+        }
+        area = -area;
+    }
+    return area;
+}
+
+/*
+    Finds the pixels on row y where every edge equation is >= its threshold
+    Each edge equation is linear in x, so instead of testing every pixel we solve
+    a*x + b*y + c >= threshold for x once per edge and intersect the three ranges.
+    The result is written to x_left and x_right (inclusive).
+    Returns false if there are no such pixels on this row.
+*/
+bool edgeSpan(const EdgeEquation edges[3], const float thresholds[3], float y,
+              int& x_left, int& x_right) {
+    float x_min = -1e30f;
+    float x_max = 1e30f;
+
+    for (int i = 0; i < 3; i++) {
+        float rhs = thresholds[i] - edges[i].b * y - edges[i].c;
+        if (edges[i].a > 0) {
+            x_min = max(x_min, rhs / edges[i].a);
+        } else if (edges[i].a < 0) {
+            x_max = min(x_max, rhs / edges[i].a);
+        } else if (rhs > 0) {
+            return false; // horizontal edge, and this whole row is on its outside
+        }
+    }
+
+    if (x_min > x_max) return false;
+
+    // Keep the values in int range before converting (x_min/x_max can still be +-1e30)
+    x_min = max(x_min, -1e9f);
+    x_max = min(x_max, 1e9f);
+    x_left = (int)ceil(x_min);
+    x_right = (int)floor(x_max);
+    return x_left <= x_right;
+}
+
+/*
+    Helper function that mixes the three vertex colors using barycentric weights
+    The weights should add up to 1 (w0 + w1 + w2 = 1)
+    linear: mix in linear light
+*/
+Uint32 barycentricColor(Uint32 c0, Uint32 c1, Uint32 c2, float w0, float w1, float w2, bool linear) {
+    const SrgbTables& tables = srgbTables();
+    Uint32 result = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        if (linear && shift > 0) {
+            // Color channels: mix in linear light (see interpolateColorLinear())
+            float channel = tables.toLinear[(c0 >> shift) & 0xFF] * w0
+                          + tables.toLinear[(c1 >> shift) & 0xFF] * w1
+                          + tables.toLinear[(c2 >> shift) & 0xFF] * w2;
+            int value = (int)(channel + 0.5f);
+            if (value < 0) value = 0;
+            if (value > 4095) value = 4095;
+            result |= (Uint32)tables.toSrgb[value] << shift;
+            continue;
+        }
+        float channel = ((c0 >> shift) & 0xFF) * w0
+                      + ((c1 >> shift) & 0xFF) * w1
+                      + ((c2 >> shift) & 0xFF) * w2;
+        int value = (int)(channel + 0.5f);
+        if (value < 0) value = 0;
+        if (value > 255) value = 255;
+        result |= (Uint32)value << shift;
+    }
+    return result;
+}
+
+/*
+    Anti-aliased version of fillTriangle()
+    Instead of a pixel being either fully inside or fully outside, each pixel gets a
+    coverage value (0.0 to 1.0) estimated from its distance to the triangle's edges.
+        - Interior pixels (at least half a pixel away from every edge) are fully covered,
+          so each row's interior is one gradient span, drawn by fillSpan() just like fillTriangle().
+        - Edge pixels (within half a pixel of an edge) are blended with what is already
+          on the screen based on their coverage.
+    No extra memory is needed (unlike MSAA, which stores several samples per pixel),
+    and only the few pixels along the edges pay for the extra math.
+*/
+void fillTriangleAA(Screen& screen, Vertex v0, Vertex v1, Vertex v2) {
+    // Vertex coordinates are relative to the viewport
+    v0.x += screen.viewport.x; v0.y += screen.viewport.y;
+    v1.x += screen.viewport.x; v1.y += screen.viewport.y;
+    v2.x += screen.viewport.x; v2.y += screen.viewport.y;
+
+    // Step 1: Set up the edge equations
+    EdgeEquation edges[3];
+    float area = setupEdgeEquations(v0, v1, v2, edges);
+    if (area == 0) return; // collinear, nothing to draw
+
+    // Step 2: Normalize the equations so they measure distance in pixels
+    // (the original lengths are kept to turn distances back into barycentric weights)
+    float lengths[3];
+    for (int i = 0; i < 3; i++) {
+        lengths[i] = sqrt(edges[i].a * edges[i].a + edges[i].b * edges[i].b);
+        edges[i].a /= lengths[i];
+        edges[i].b /= lengths[i];
+        edges[i].c /= lengths[i];
+    }
+
+    // Pixels at least half a pixel inside every edge are fully covered,
+    // pixels more than half a pixel outside any edge are not covered at all
+    float innerThresholds[3] = {0.5f, 0.5f, 0.5f};
+    float outerThresholds[3] = {-0.5f, -0.5f, -0.5f};
+
+    // Step 3: Find the rows (and columns) the triangle can touch, clamped to the clip rectangle
+    ClipRect clip = clipRect(screen);
+    int minX = max(min(v0.x, min(v1.x, v2.x)) - 1, clip.x);
+    int maxX = min(max(v0.x, max(v1.x, v2.x)) + 1, clip.x + clip.width - 1);
+    int minY = max(min(v0.y, min(v1.y, v2.y)) - 1, clip.y);
+    int maxY = min(max(v0.y, max(v1.y, v2.y)) + 1, clip.y + clip.height - 1);
+    if (minX > maxX) return;
+
+    // Color at a pixel from its distances to the edges
+    // (distance * edge length = edge function, divided by the area = barycentric weight)
+    auto colorAt = [&](float d0, float d1, float d2) {
+        float w0 = max(d0 * lengths[0] / area, 0.0f);
+        float w1 = max(d1 * lengths[1] / area, 0.0f);
+        float w2 = max(d2 * lengths[2] / area, 0.0f);
+        float sum = w0 + w1 + w2;
+        return barycentricColor(v0.color, v1.color, v2.color, w0 / sum, w1 / sum, w2 / sum, screen.linearColor);
+    };
+
+    // Blends the edge pixels x_from to x_to of row y. The distances come from
+    // rasterKernels().evaluateEdges(), a chunk at a time so they fit on the stack
+    const int CHUNK = 64;
+    float dist0[CHUNK], dist1[CHUNK], dist2[CHUNK];
+    auto blendEdgePixels = [&](Uint32* row, int y, int x_from, int x_to) {
+        for (int chunk = x_from; chunk <= x_to; chunk += CHUNK) {
+            int count = min(CHUNK, x_to - chunk + 1);
+            rasterKernels().evaluateEdges(edges, y, chunk, count, dist0, dist1, dist2);
+            for (int i = 0; i < count; i++) {
+                int x = chunk + i;
+
+                // Estimate the covered fraction from each edge
+                float c0 = min(max(dist0[i] + 0.5f, 0.0f), 1.0f);
+                float c1 = min(max(dist1[i] + 0.5f, 0.0f), 1.0f);
+                float c2 = min(max(dist2[i] + 0.5f, 0.0f), 1.0f);
+                float coverage = c0 * c1 * c2;
+
+                // Uncovered pixels aren't drawn, so they must not touch the stencil either
+                if (coverage <= 0 || !stencilPass(screen, y * screen.width + x)) continue;
+
+                // Blend on top of the pixel that is already there
+                row[x] = mixColor(row[x], colorAt(dist0[i], dist1[i], dist2[i]), coverage, screen.linearColor);
+            }
+        }
+    };
+
+    // Step 4: Scan from top to bottom
+    for (int y = minY; y <= maxY; y++) {
+        int outer_left, outer_right;
+        if (!edgeSpan(edges, outerThresholds, (float)y, outer_left, outer_right)) continue;
+        outer_left = max(outer_left, minX);
+        outer_right = min(outer_right, maxX);
+        if (outer_left > outer_right) continue;
+        Uint32* row = screen.pixels + y * screen.width; // already clamped, no per-pixel bounds checks
+
+        // The interior span (may be empty for thin triangles or rows near a vertex)
+        int inner_left = outer_right + 1, inner_right = outer_right;
+        int left, right;
+        if (edgeSpan(edges, innerThresholds, (float)y, left, right)) {
+            left = max(left, outer_left);
+            right = min(right, outer_right);
+            if (left <= right) {
+                inner_left = left;
+                inner_right = right;
+            }
+        }
+
+        // Fully covered interior: the color is linear along the row, so a gradient between
+        // the colors at both ends gives the same pixels as computing every one of them
+        if (inner_left <= inner_right) {
+            float d_left[3], d_right[3];
+            for (int i = 0; i < 3; i++) {
+                d_left[i] = edges[i].a * inner_left + edges[i].b * y + edges[i].c;
+                d_right[i] = edges[i].a * inner_right + edges[i].b * y + edges[i].c;
+            }
+            fillSpan(screen, y, inner_left, inner_right, inner_left, inner_right,
+                     colorAt(d_left[0], d_left[1], d_left[2]), colorAt(d_right[0], d_right[1], d_right[2]));
+        }
+
+        // Partly covered pixels on both sides of it
+        blendEdgePixels(row, y, outer_left, inner_left - 1);
+        blendEdgePixels(row, y, inner_right + 1, outer_right);
+    }
+}
+
+/*
+    Conservative rasterization
+    fillTriangle() only draws pixels whose centers are inside the triangle, so thin triangles
+    (or thin parts of triangles) can slip between pixel centers and draw nothing at all.
+    This version draws every pixel that the triangle touches, even a tiny corner of it,
+    which is what occupancy grids and collision masks need.
+
+    It is built into the edge equation setup: each edge is pushed outward by the distance
+    from a pixel's center to its furthest corner in the direction of the edge, 0.5 * (|a| + |b|).
+    A pixel passes the pushed-out edge if any part of its square is on the inside of the original edge.
+    The edges alone would let long thin points poke out too far, so the pixels are also kept inside
+    the triangle's bounding box.
+    Collinear vertices (a line) still draw the pixels the line passes through.
+*/
+void expandEdgesConservative(EdgeEquation edges[3]) {
+    for (int i = 0; i < 3; i++) {
+        edges[i].c += 0.5f * (fabs(edges[i].a) + fabs(edges[i].b));
+    }
+}
+
+void fillTriangleConservative(Screen& screen, Vertex v0, Vertex v1, Vertex v2) {
+    // Vertex coordinates are relative to the viewport
+    v0.x += screen.viewport.x; v0.y += screen.viewport.y;
+    v1.x += screen.viewport.x; v1.y += screen.viewport.y;
+    v2.x += screen.viewport.x; v2.y += screen.viewport.y;
+
+    // Step 1: Set up the edge equations, and a pushed-out copy for the coverage test
+    // (the original ones are still used to interpolate the colors)
+    EdgeEquation edges[3];
+    float area = setupEdgeEquations(v0, v1, v2, edges);
+    EdgeEquation expanded[3] = {edges[0], edges[1], edges[2]};
+    expandEdgesConservative(expanded);
+    float thresholds[3] = {0.0f, 0.0f, 0.0f};
+
+    // Step 2: Every pixel that overlaps the bounding box, clamped to the clip rectangle
+    ClipRect clip = clipRect(screen);
+    int minX = max(min(v0.x, min(v1.x, v2.x)), clip.x);
+    int maxX = min(max(v0.x, max(v1.x, v2.x)), clip.x + clip.width - 1);
+    int minY = max(min(v0.y, min(v1.y, v2.y)), clip.y);
+    int maxY = min(max(v0.y, max(v1.y, v2.y)), clip.y + clip.height - 1);
+
+    // Step 3: Scan from top to bottom
+    for (int y = minY; y <= maxY; y++) {
+        int x_left, x_right;
+        if (!edgeSpan(expanded, thresholds, (float)y, x_left, x_right)) continue;
+        x_left = max(x_left, minX);
+        x_right = min(x_right, maxX);
+
+        Uint32* row = screen.pixels + y * screen.width;
+        for (int x = x_left; x <= x_right; x++) {
+            if (!stencilPass(screen, y * screen.width + x)) continue;
+
+            if (area == 0) {
+                row[x] = v0.color; // a line has no inside to interpolate across
+                continue;
+            }
+
+            // Barycentric weights, clamped for pixels whose centers are outside the triangle
+            float w0 = max((edges[0].a * x + edges[0].b * y + edges[0].c) / area, 0.0f);
+            float w1 = max((edges[1].a * x + edges[1].b * y + edges[1].c) / area, 0.0f);
+            float w2 = max((edges[2].a * x + edges[2].b * y + edges[2].c) / area, 0.0f);
+            float sum = w0 + w1 + w2;
+            if (sum <= 0) {
+                row[x] = v0.color;
+            } else {
+                row[x] = barycentricColor(v0.color, v1.color, v2.color, w0 / sum, w1 / sum, w2 / sum, screen.linearColor);
+            }
+        }
+    }
+}
+
+/*
+    Fills a path made of one or more closed contours (the last point connects back to the first)
+    The path can be concave, have holes, or cross itself; there is no need to triangulate it first.
+
+    This is the general version of the scanline idea in fillTriangle(). A triangle always has exactly
+    two edges on each scanline, but a path can have any number, so we keep:
+        - the edge table: every edge, sorted by the row it starts on
+        - the active edge list: only the edges that cross the current row, sorted by x
+    Moving down a row only adds the edges that start there and removes the ones that end,
+    so we never look at edges that are nowhere near the current row.
+
+    With anti-aliasing on, each pixel row is sampled PATH_AA_SAMPLES times vertically and each span's
+    exact horizontal overlap with its end pixels is measured, giving every pixel a coverage value.
+    Pixels that are fully covered are written directly, the rest are blended with the background.
+*/
+void fillPath(Screen& screen, const vector<vector<PathPoint>>& contours, Uint32 color,
+              FillRule rule, bool antiAliasing) {
+    FrameArenaScope arenaScope; // the scratch memory below is freed on return
+
+    // Step 1: Build the edge table (horizontal edges never cross a sample row, so they are skipped)
+    FrameVector<PathEdge> edgeTable;
+    float y_min = 1e30f;
+    float y_max = -1e30f;
+    for (const auto& contour : contours) {
+        for (size_t i = 0; i < contour.size(); i++) {
+            PathPoint p = contour[i];
+            PathPoint q = contour[(i + 1) % contour.size()];
+            // Path coordinates are relative to the viewport
+            p.x += screen.viewport.x; p.y += screen.viewport.y;
+            q.x += screen.viewport.x; q.y += screen.viewport.y;
+            if (p.y == q.y) continue;
+
+            PathEdge edge;
+            edge.winding = (p.y < q.y) ? 1 : -1;
+            if (p.y > q.y) swap(p, q);
+            edge.y_top = p.y;
+            edge.y_bottom = q.y;
+            edge.x_top = p.x;
+            edge.slope = (q.x - p.x) / (q.y - p.y);
+            edge.x = p.x;
+            edgeTable.push_back(edge);
+
+            y_min = min(y_min, p.y);
+            y_max = max(y_max, q.y);
+        }
+    }
+    if (edgeTable.empty()) return;
+
+    sort(edgeTable.begin(), edgeTable.end(), [](const PathEdge& a, const PathEdge& b) {
+        return a.y_top < b.y_top;
+    });
+
+    // Step 2: Only scan the rows that are both on the path and inside the clip rectangle
+    ClipRect clip = clipRect(screen);
+    if (clip.width == 0 || clip.height == 0) return;
+    int clip_right = clip.x + clip.width - 1;
+    int y_first = max((int)floor(y_min), clip.y);
+    int y_last = min((int)ceil(y_max), clip.y + clip.height - 1);
+
+    int samples = antiAliasing ? PATH_AA_SAMPLES : 1;
+    float sampleWeight = 1.0f / samples;
+
+    /*
+        Coverage for the current row is accumulated in two buffers (indexed from clip.x):
+            - partial: coverage of the pixels at the ends of a span
+            - runs: +w where a run of fully covered pixels starts, -w where it stops
+                    (adding up runs from left to right gives the coverage of every pixel in between,
+                    so a long span costs the same as a short one)
+    */
+    FrameVector<float> partial(clip.width + 1, 0.0f);
+    FrameVector<float> runs(clip.width + 1, 0.0f);
+
+    FrameVector<PathEdge*> active;
+    size_t nextEdge = 0;
+
+    // Step 3: Scan from top to bottom
+    for (int y = y_first; y <= y_last; y++) {
+        int touched_left = clip.width;  // range of pixels that got any coverage on this row
+        int touched_right = -1;
+
+        for (int s = 0; s < samples; s++) {
+            // Sample rows are spread evenly over the pixel (the pixel's center is at y)
+            float sample_y = (samples == 1) ? (float)y : y - 0.5f + (s + 0.5f) / samples;
+
+            // Add edges that start at or above this sample row, drop edges that end above it
+            while (nextEdge < edgeTable.size() && edgeTable[nextEdge].y_top <= sample_y) {
+                active.push_back(&edgeTable[nextEdge]);
+                nextEdge++;
+            }
+            for (size_t i = 0; i < active.size(); ) {
+                if (active[i]->y_bottom <= sample_y || active[i]->y_top > sample_y) {
+                    active.erase(active.begin() + i);
+                } else {
+                    active[i]->x = active[i]->x_top + (sample_y - active[i]->y_top) * active[i]->slope;
+                    i++;
+                }
+            }
+
+            // Sort by x (insertion sort, the order barely changes from one sample row to the next)
+            for (size_t i = 1; i < active.size(); i++) {
+                PathEdge* edge = active[i];
+                size_t j = i;
+                while (j > 0 && active[j - 1]->x > edge->x) {
+                    active[j] = active[j - 1];
+                    j--;
+                }
+                active[j] = edge;
+            }
+
+            // Walk the edges from left to right, keeping count of the winding number
+            int winding = 0;
+            for (size_t i = 0; i + 1 < active.size(); i++) {
+                winding += (rule == FILL_NON_ZERO) ? active[i]->winding : 1;
+                bool inside = (rule == FILL_NON_ZERO) ? (winding != 0) : (winding % 2 != 0);
+                if (!inside) continue;
+
+                // The span between this edge and the next one is inside the path
+                // (converted to be relative to clip.x and clamped to the clip rectangle)
+                float x_start = max(active[i]->x, clip.x - 0.5f) - clip.x;
+                float x_end = min(active[i + 1]->x, clip_right + 0.5f) - clip.x;
+                if (x_start >= x_end) continue;
+
+                if (!antiAliasing) {
+                    // Pixels whose centers are inside [x_start, x_end)
+                    int first = (int)ceil(x_start);
+                    int last = (int)ceil(x_end) - 1;
+                    if (first > last) continue;
+                    runs[first] += 1.0f;
+                    runs[last + 1] -= 1.0f;
+                    touched_left = min(touched_left, first);
+                    touched_right = max(touched_right, last);
+                    continue;
+                }
+
+                // Pixel x covers [x - 0.5, x + 0.5), so shift by 0.5 to make pixel x cover [x, x + 1)
+                float left = x_start + 0.5f;
+                float right = x_end + 0.5f;
+                int first = (int)left;
+                int last = (int)right;
+                if (last >= clip.width) last = clip.width - 1;
+
+                if (first == last) {
+                    // The whole span is inside one pixel
+                    partial[first] += (right - left) * sampleWeight;
+                } else {
+                    // Partly covered end pixels, then a run of fully covered pixels in between
+                    partial[first] += (first + 1 - left) * sampleWeight;
+                    if (right > last) partial[last] += (right - last) * sampleWeight;
+                    runs[first + 1] += sampleWeight;
+                    runs[last] -= sampleWeight;
+                }
+                touched_left = min(touched_left, first);
+                touched_right = max(touched_right, last);
+            }
+        }
+
+        // Step 4: Resolve this row's coverage into pixels and reset the buffers
+        Uint32* row = screen.pixels + y * screen.width + clip.x;
+        float run = 0.0f;
+        for (int x = touched_left; x <= touched_right; x++) {
+            run += runs[x];
+            float coverage = min(run + partial[x], 1.0f);
+            runs[x] = 0.0f;
+            partial[x] = 0.0f;
+
+            if (coverage <= 0.0f) continue;
+            if (!stencilPass(screen, y * screen.width + clip.x + x)) continue;
+
+            if (coverage >= 0.999f) {
+                row[x] = color; // fully covered, no need to blend
+            } else {
+                row[x] = mixColor(row[x], color, coverage, screen.linearColor);
+            }
+        }
+        if (touched_right >= 0) {
+            runs[touched_right + 1] = 0.0f;
+        }
+    }
+}
+
+/*
+    Polygon triangulation (monotone decomposition)
+    fillPath() can fill any polygon directly, but some content has to go through fillTriangle()
+    (gradients from per-vertex colors, strips, etc.), so it needs to be split into triangles first.
+
+    Ear clipping is the simple way to do this, but it is O(n^2). Instead we do it in two passes:
+        1. Split the polygon into "y-monotone" pieces: pieces where every horizontal line crosses
+           the boundary at most twice. A sweep line moves from top to bottom and adds a diagonal
+           at every vertex where the polygon would stop being monotone. O(n log n)
+        2. Triangulate each monotone piece by walking down its left and right chains with a stack. O(n)
+    Reference: de Berg et al., Computational Geometry: Algorithms and Applications, chapter 3.
+
+    Inside the triangulator, y is flipped (y goes up) so the usual math definitions of
+    "above" and "counter-clockwise" apply.
+*/
+namespace triangulation {
+
+struct Point {
+    long long x;
+    long long y;
+};
+
+// a is above b if it has a larger y (ties: the one further left is above)
+bool above(const Point& a, const Point& b) {
+    return a.y > b.y || (a.y == b.y && a.x < b.x);
+}
+
+// > 0 if o -> a -> b turns left (counter-clockwise), < 0 if it turns right, 0 if collinear
+long long cross(const Point& o, const Point& a, const Point& b) {
+    return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+}
+
+enum VertexType { START, END, SPLIT, MERGE, REGULAR };
+
+/*
+    Shared state of the sweep
+    Edge i goes from point i to point i + 1. The sweep status holds the edges that cross
+    the sweep line and have the inside of the polygon to their right, ordered by x.
+*/
+struct Sweep {
+    const vector<Point>* points;
+    long long y;            // current height of the sweep line
+    long long x;            // x of the current event vertex (used for horizontal edges)
+
+    // x where edge i crosses the sweep line
+    double edgeX(int edge) const {
+        const Point& a = (*points)[edge];
+        const Point& b = (*points)[(edge + 1) % points->size()];
+        if (a.y == b.y) {
+            // Horizontal edge: it is crossed right where the sweep currently is
+            return (double)min(max(x, min(a.x, b.x)), max(a.x, b.x));
+        }
+        return a.x + (double)(b.x - a.x) * (double)(y - a.y) / (double)(b.y - a.y);
+    }
+};
+
+// Orders edges in the sweep status by where they cross the sweep line
+// (edge -1 stands for the current event vertex, used to search the status)
+struct StatusOrder {
+    const Sweep* sweep;
+    bool operator()(int a, int b) const {
+        double xa = (a < 0) ? (double)sweep->x : sweep->edgeX(a);
+        double xb = (b < 0) ? (double)sweep->x : sweep->edgeX(b);
+        return xa < xb;
+    }
+};
+
+/*
+    Step 1: find the diagonals that split the polygon into y-monotone pieces
+    points must be in counter-clockwise order. Returns pairs of point indices.
+*/
+vector<pair<int, int>> monotoneDiagonals(const vector<Point>& points) {
+    int n = (int)points.size();
+    vector<pair<int, int>> diagonals;
+
+    // Classify every vertex by its neighbors
+    vector<VertexType> types(n);
+    for (int i = 0; i < n; i++) {
+        const Point& prev = points[(i + n - 1) % n];
+        const Point& next = points[(i + 1) % n];
+        bool convex = cross(prev, points[i], next) > 0; // interior angle < 180 degrees
+        if (above(points[i], prev) && above(points[i], next)) {
+            types[i] = convex ? START : SPLIT;
+        } else if (above(prev, points[i]) && above(next, points[i])) {
+            types[i] = convex ? END : MERGE;
+        } else {
+            types[i] = REGULAR;
+        }
+    }
+
+    // Event queue: vertices from top to bottom
+    vector<int> order(n);
+    for (int i = 0; i < n; i++) order[i] = i;
+    sort(order.begin(), order.end(), [&](int a, int b) { return above(points[a], points[b]); });
+
+    Sweep sweep;
+    sweep.points = &points;
+    StatusOrder statusOrder;
+    statusOrder.sweep = &sweep;
+    set<int, StatusOrder> status(statusOrder);
+    vector<int> helper(n, -1); // helper[e]: lowest vertex above the sweep line that can see edge e
+
+    // The edge directly to the left of the current event vertex
+    auto leftEdge = [&]() {
+        auto it = status.upper_bound(-1);
+        if (it == status.begin()) return -1; // shouldn't happen in a simple polygon
+        return *(--it);
+    };
+    auto connectIfMerge = [&](int v, int edge) {
+        if (edge >= 0 && helper[edge] >= 0 && types[helper[edge]] == MERGE) {
+            diagonals.push_back(make_pair(v, helper[edge]));
+        }
+    };
+
+    for (int v : order) {
+        sweep.y = points[v].y;
+        sweep.x = points[v].x;
+        int prevEdge = (v + n - 1) % n; // edge ending at v
+        int nextEdge = v;               // edge starting at v
+
+        switch (types[v]) {
+            case START:
+                status.insert(nextEdge);
+                helper[nextEdge] = v;
+                break;
+            case END:
+                connectIfMerge(v, prevEdge);
+                status.erase(prevEdge);
+                break;
+            case SPLIT: {
+                int left = leftEdge();
+                if (left >= 0) {
+                    diagonals.push_back(make_pair(v, helper[left]));
+                    helper[left] = v;
+                }
+                status.insert(nextEdge);
+                helper[nextEdge] = v;
+                break;
+            }
+            case MERGE: {
+                connectIfMerge(v, prevEdge);
+                status.erase(prevEdge);
+                int left = leftEdge();
+                connectIfMerge(v, left);
+                if (left >= 0) helper[left] = v;
+                break;
+            }
+            case REGULAR:
+                if (above(points[(v + n - 1) % n], points[v])) {
+                    // On the left side of the polygon (inside is to the right)
+                    connectIfMerge(v, prevEdge);
+                    status.erase(prevEdge);
+                    status.insert(nextEdge);
+                    helper[nextEdge] = v;
+                } else {
+                    // On the right side of the polygon
+                    int left = leftEdge();
+                    connectIfMerge(v, left);
+                    if (left >= 0) helper[left] = v;
+                }
+                break;
+        }
+    }
+    return diagonals;
+}
+
+/*
+    Splits the polygon along the diagonals and returns each piece as a counter-clockwise list of point indices
+    Every vertex gets a list of its neighbors (polygon edges + diagonals) sorted by angle. Walking a piece's
+    boundary, at each vertex we take the next neighbor clockwise from the one we came from,
+    which keeps the piece on our left.
+*/
+vector<vector<int>> splitPieces(const vector<Point>& points, const vector<pair<int, int>>& diagonals) {
+    int n = (int)points.size();
+    vector<vector<int>> neighbors(n);
+    for (int i = 0; i < n; i++) {
+        neighbors[i].push_back((i + 1) % n);
+        neighbors[i].push_back((i + n - 1) % n);
+    }
+    for (const auto& d : diagonals) {
+        neighbors[d.first].push_back(d.second);
+        neighbors[d.second].push_back(d.first);
+    }
+    for (int i = 0; i < n; i++) {
+        sort(neighbors[i].begin(), neighbors[i].end(), [&](int a, int b) {
+            return atan2((double)(points[a].y - points[i].y), (double)(points[a].x - points[i].x))
+                 < atan2((double)(points[b].y - points[i].y), (double)(points[b].x - points[i].x));
+        });
+    }
+
+    // Directed edges that still need to be walked: polygon edges (i -> i+1) and both directions of
+    // each diagonal. The reversed polygon edges would walk around the outside, so they are never used.
+    set<pair<int, int>> unused;
+    for (int i = 0; i < n; i++) unused.insert(make_pair(i, (i + 1) % n));
+    for (const auto& d : diagonals) {
+        unused.insert(d);
+        unused.insert(make_pair(d.second, d.first));
+    }
+
+    vector<vector<int>> pieces;
+    while (!unused.empty()) {
+        pair<int, int> start = *unused.begin();
+        vector<int> piece;
+        int from = start.first;
+        int to = start.second;
+        while (true) {
+            unused.erase(make_pair(from, to));
+            piece.push_back(from);
+
+            // Next neighbor clockwise from "from" around "to"
+            const vector<int>& around = neighbors[to];
+            size_t k = find(around.begin(), around.end(), from) - around.begin();
+            int next = around[(k + around.size() - 1) % around.size()];
+            from = to;
+            to = next;
+            if (from == start.first && to == start.second) break;
+            if (piece.size() > (size_t)n) break; // safety net for invalid (self-intersecting) input
+        }
+        pieces.push_back(piece);
+    }
+    return pieces;
+}
+
+/*
+    Step 2: triangulate one y-monotone piece (counter-clockwise list of point indices)
+    Vertices are visited from top to bottom. The stack holds vertices that still need triangles;
+    they always form a reflex chain, so each new vertex either:
+        - is on the opposite chain: it can see every vertex on the stack -> fan of triangles
+        - is on the same chain: it cuts off triangles for as long as they are inside the piece
+*/
+void triangulateMonotone(const vector<Point>& points, const vector<int>& piece, vector<int>& indices) {
+    int k = (int)piece.size();
+    if (k < 3) return;
+
+    // Find the top and bottom vertices and mark which chain every vertex is on
+    int top = 0;
+    int bottom = 0;
+    for (int i = 1; i < k; i++) {
+        if (above(points[piece[i]], points[piece[top]])) top = i;
+        if (above(points[piece[bottom]], points[piece[i]])) bottom = i;
+    }
+    vector<bool> leftChain(k, false);
+    for (int i = top; i != bottom; i = (i + 1) % k) {
+        leftChain[i] = true; // going counter-clockwise from the top walks down the left side
+    }
+
+    vector<int> order(k);
+    for (int i = 0; i < k; i++) order[i] = i;
+    sort(order.begin(), order.end(), [&](int a, int b) { return above(points[piece[a]], points[piece[b]]); });
+
+    vector<int> stack;
+    stack.push_back(order[0]);
+    stack.push_back(order[1]);
+
+    for (int j = 2; j < k; j++) {
+        int u = order[j];
+        const Point& pu = points[piece[u]];
+
+        if (j == k - 1 || leftChain[u] != leftChain[stack.back()]) {
+            // Opposite chain (or the bottom vertex, which is on both): fan to the whole stack
+            for (size_t s = 0; s + 1 < stack.size(); s++) {
+                indices.push_back(piece[u]);
+                indices.push_back(piece[stack[s]]);
+                indices.push_back(piece[stack[s + 1]]);
+            }
+            int last = stack.back();
+            stack.clear();
+            stack.push_back(last);
+            stack.push_back(u);
+        } else {
+            // Same chain: cut off triangles while the diagonal stays inside the piece
+            int last = stack.back();
+            stack.pop_back();
+            while (!stack.empty()) {
+                const Point& pl = points[piece[last]];
+                const Point& pn = points[piece[stack.back()]];
+                bool inside = leftChain[u] ? cross(pn, pl, pu) > 0 : cross(pu, pl, pn) > 0;
+                if (!inside) break;
+                indices.push_back(piece[u]);
+                indices.push_back(piece[last]);
+                indices.push_back(piece[stack.back()]);
+                last = stack.back();
+                stack.pop_back();
+            }
+            stack.push_back(last);
+            stack.push_back(u);
+        }
+    }
+}
+
+} // namespace triangulation
+
+/*
+    Triangulates a simple polygon (vertices in order around the outside, either direction, no self-intersections)
+    Returns indices into polygon, 3 per triangle. Collinear (zero area) triangles are dropped.
+*/
+vector<int> triangulatePolygon(const vector<Vertex>& polygon) {
+    using namespace triangulation;
+    vector<int> indices;
+
+    // Step 1: Drop repeated points, flip y so it goes up, and make the order counter-clockwise
+    vector<int> original; // index in polygon for each point
+    for (size_t i = 0; i < polygon.size(); i++) {
+        const Vertex& v = polygon[i];
+        if (!original.empty()) {
+            const Vertex& last = polygon[original.back()];
+            if (last.x == v.x && last.y == v.y) continue;
+        }
+        original.push_back((int)i);
+    }
+    while (original.size() > 1 && polygon[original.front()].x == polygon[original.back()].x
+                               && polygon[original.front()].y == polygon[original.back()].y) {
+        original.pop_back();
+    }
+    if (original.size() < 3) return indices;
+
+    vector<Point> points;
+    long long area = 0;
+    for (int i : original) {
+        Point p = {polygon[i].x, -(long long)polygon[i].y};
+        points.push_back(p);
+    }
+    for (size_t i = 0; i < points.size(); i++) {
+        const Point& a = points[i];
+        const Point& b = points[(i + 1) % points.size()];
+        area += a.x * b.y - b.x * a.y;
+    }
+    if (area == 0) return indices;
+    if (area < 0) {
+        reverse(points.begin(), points.end());
+        reverse(original.begin(), original.end());
+    }
+
+    // Step 2: Split into monotone pieces and triangulate each one
+    vector<pair<int, int>> diagonals = monotoneDiagonals(points);
+    vector<vector<int>> pieces = splitPieces(points, diagonals);
+    vector<int> local;
+    for (const auto& piece : pieces) {
+        triangulateMonotone(points, piece, local);
+    }
+
+    // Step 3: Map back to the caller's indices, dropping degenerate triangles
+    for (size_t t = 0; t + 2 < local.size(); t += 3) {
+        int a = original[local[t]];
+        int b = original[local[t + 1]];
+        int c = original[local[t + 2]];
+        if (isCollinear(polygon[a], polygon[b], polygon[c])) continue;
+        indices.push_back(a);
+        indices.push_back(b);
+        indices.push_back(c);
+    }
+    return indices;
+}
+
+// FNV-1a hash of a polygon's positions
+Uint64 hashPolygon(const vector<Vertex>& polygon) {
+    Uint64 hash = 14695981039346656037ULL;
+    for (const Vertex& v : polygon) {
+        Uint32 coords[2] = {(Uint32)v.x, (Uint32)v.y};
+        for (int i = 0; i < 2; i++) {
+            for (int byte = 0; byte < 4; byte++) {
+                hash ^= (coords[i] >> (byte * 8)) & 0xFF;
+                hash *= 1099511628211ULL;
+            }
+        }
+    }
+    return hash;
+}
+
+// Looks up the polygon's triangulation, triangulating it (and caching the result) if it's new
+const vector<int>& triangulateCached(TriangulationCache& cache, const vector<Vertex>& polygon) {
+    vector<CachedTriangulation>& bucket = cache.entries[hashPolygon(polygon)];
+
+    for (const CachedTriangulation& entry : bucket) {
+        if (entry.positions.size() != polygon.size() * 2) continue;
+        bool same = true;
+        for (size_t i = 0; i < polygon.size() && same; i++) {
+            same = entry.positions[2 * i] == polygon[i].x && entry.positions[2 * i + 1] == polygon[i].y;
+        }
+        if (same) return entry.indices;
+    }
+
+    CachedTriangulation entry;
+    for (const Vertex& v : polygon) {
+        entry.positions.push_back(v.x);
+        entry.positions.push_back(v.y);
+    }
+    entry.indices = triangulatePolygon(polygon);
+    bucket.push_back(entry);
+    return bucket.back().indices;
+}
+
+// Fills a simple (possibly concave) polygon with fillTriangle(), using the cache for its triangulation
+void fillPolygon(Screen& screen, TriangulationCache& cache, const vector<Vertex>& polygon) {
+    const vector<int>& indices = triangulateCached(cache, polygon);
+    for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+        fillTriangle(screen, polygon[indices[t]], polygon[indices[t + 1]], polygon[indices[t + 2]]);
+    }
+}
+
+// Both sides positive and width * height (worked out in size_t, so it can't overflow) not too big
+bool validScreenSize(int width, int height) {
+    if (width <= 0 || height <= 0) return false;
+    return (size_t)width <= MAX_SCREEN_PIXELS / (size_t)height;
+}
+
+/*
+    Creates a screen that only exists in memory (no window, renderer or texture)
+    Used when we need to render at a different resolution than the window, like supersampling.
+    Free it with destroyOffscreen() when done.
+    If the size is invalid (see validScreenSize()) the screen is 0x0 and its pixels are NULL.
+*/
+Screen createOffscreen(int width, int height) {
+    Screen screen;
+    screen.window = NULL;
+    screen.renderer = NULL;
+    screen.texture = NULL;
+    screen.width = 0;
+    screen.height = 0;
+    screen.pixels = NULL;
+    screen.stencil = NULL;
+    if (!validScreenSize(width, height)) {
+        cout << "Invalid offscreen size: " << width << " x " << height << endl;
+        resetRenderState(screen);
+        return screen;
+    }
+
+    size_t count = (size_t)width * (size_t)height;
+    screen.width = width;
+    screen.height = height;
+    screen.pixels = new Uint32[count];
+    screen.stencil = new Uint8[count];
+
+    // Initialize the pixels to black
+    rasterKernels().fillRow(screen.pixels, (int)count, 0x000000FF); // Black with full alpha
+    clearStencil(screen, 0);
+    resetRenderState(screen);
+    return screen;
+}
+
+void destroyOffscreen(Screen& screen) {
+    delete[] screen.pixels;
+    delete[] screen.stencil;
+    screen.pixels = NULL;
+    screen.stencil = NULL;
+}
+
+/*
+    Box filter downsample for rows [yStart, yEnd) of the destination
+    Every destination pixel is the average of a factor x factor block of source pixels.
+
+    To average 4 channels at once without unpacking them, the 32-bit color is split into
+    two halves that each hold two channels in 16-bit "lanes":
+        0xRRGGBBAA -> (color >> 8) & 0x00FF00FF = 0x00RR00BB
+                   ->  color       & 0x00FF00FF = 0x00GG00AA
+    A lane can hold up to 65535, so we can add up to 256 samples (255 * 256 < 65536)
+    before one lane overflows into the next. This way one add sums two channels at once,
+    and the loops are simple enough for the compiler to vectorize.
+*/
+void downsampleRows(const Screen& src, Screen& dst, int factor, int yStart, int yEnd) {
+    int samples = factor * factor;
+    int shift = 0;
+    while ((1 << shift) < samples) shift++; // factor is a power of 2, so samples = 2^shift
+    Uint32 rounding = (Uint32)(samples / 2) * 0x00010001; // +0.5 in both lanes
+
+    vector<Uint32> sumRB(dst.width);
+    vector<Uint32> sumGA(dst.width);
+
+    for (int y = yStart; y < yEnd; y++) {
+        // Step 1: Start each lane at the rounding value
+        for (int x = 0; x < dst.width; x++) {
+            sumRB[x] = rounding;
+            sumGA[x] = rounding;
+        }
+
+        // Step 2: Add up the block of source pixels, one source row at a time
+        for (int sy = 0; sy < factor; sy++) {
+            const Uint32* row = src.pixels + (y * factor + sy) * src.width;
+            for (int x = 0; x < dst.width; x++) {
+                const Uint32* block = row + x * factor;
+                for (int sx = 0; sx < factor; sx++) {
+                    sumRB[x] += (block[sx] >> 8) & 0x00FF00FF;
+                    sumGA[x] += block[sx] & 0x00FF00FF;
+                }
+            }
+        }
+
+        // Step 3: Divide by the number of samples and pack the channels back together
+        Uint32* out = dst.pixels + y * dst.width;
+        for (int x = 0; x < dst.width; x++) {
+            out[x] = (((sumRB[x] >> shift) & 0x00FF00FF) << 8) | ((sumGA[x] >> shift) & 0x00FF00FF);
+        }
+    }
+}
+
+/*
+    Supersampling anti-aliasing (SSAA)
+    The triangles are rendered into an internal screen that is factor times wider and taller,
+    then every factor x factor block is averaged down to one pixel of the real screen.
+    This anti-aliases everything (edges and color gradients) but costs factor^2 times the memory
+    and fill work, so it is meant for high quality still images rather than every frame.
+    The screen's viewport and scissor are scaled up with it; the stencil test is not used
+    (the stencil buffer is only stored at the screen's resolution).
+    factor must be 2 (4 samples per pixel) or 4 (16 samples per pixel).
+    The downsample is split into bands of rows that run on separate threads.
+*/
+void renderSupersampled(Screen& screen, const vector<vector<Vertex>>& triangles, int factor) {
+    if (factor != 2 && factor != 4) {
+        cout << "Supersampling factor must be 2 or 4" << endl;
+        return;
+    }
+
+    // Step 1: Render at the higher resolution
+    Screen big = createOffscreen(screen.width * factor, screen.height * factor);
+    if (!big.pixels) return; // too big to supersample
+    ClipRect rects[2] = {screen.viewport, screen.scissor};
+    for (int i = 0; i < 2; i++) {
+        rects[i].x *= factor;
+        rects[i].y *= factor;
+        rects[i].width *= factor;
+        rects[i].height *= factor;
+    }
+    big.viewport = rects[0];
+    big.scissor = rects[1];
+    big.scissorEnabled = screen.scissorEnabled;
+
+    // Copy what is already on the screen so the triangles are drawn over it
+    for (int y = 0; y < big.height; y++) {
+        for (int x = 0; x < big.width; x++) {
+            big.pixels[y * big.width + x] = screen.pixels[(y / factor) * screen.width + (x / factor)];
+        }
+    }
+
+    for (const auto& triangle : triangles) {
+        // Scale each vertex so it lands in the center of its block of samples
+        Vertex scaled[3];
+        for (int i = 0; i < 3; i++) {
+            scaled[i] = triangle[i];
+            scaled[i].x = triangle[i].x * factor + factor / 2;
+            scaled[i].y = triangle[i].y * factor + factor / 2;
+        }
+        fillTriangle(big, scaled[0], scaled[1], scaled[2]);
+    }
+
+    // Step 2: Downsample back to the screen's resolution
+    parallelRows(screen.height, [&](int yStart, int yEnd) {
+        downsampleRows(big, screen, factor, yStart, yEnd);
+    });
+
+    destroyOffscreen(big);
+}
+
+
+// Float <-> half float (IEEE 754 binary16: 1 sign bit, 5 exponent bits, 10 mantissa bits)
+Uint16 floatToHalf(float value) {
+    Uint32 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    Uint32 sign = (bits >> 16) & 0x8000;
+    int floatExponent = (bits >> 23) & 0xFF;
+    int exponent = floatExponent - 127 + 15;
+    Uint32 mantissa = bits & 0x7FFFFF;
+
+    if (floatExponent == 0xFF) return sign | 0x7C00 | (mantissa ? 0x200 : 0); // infinity or NaN
+    if (exponent >= 31) return sign | 0x7C00;                                 // too big: infinity
+    if (exponent <= 0) {
+        // Too small for a normal half: subnormal or zero
+        if (exponent < -10) return sign;
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        Uint32 half = mantissa >> shift;
+        if ((mantissa >> (shift - 1)) & 1) half++; // round
+        return sign | half;
+    }
+    Uint32 half = sign | (exponent << 10) | (mantissa >> 13);
+    if (mantissa & 0x1000) half++; // round (a carry into the exponent is still right)
+    return half;
+}
+
+float halfToFloat(Uint16 half) {
+    Uint32 sign = (Uint32)(half & 0x8000) << 16;
+    int exponent = (half >> 10) & 0x1F;
+    Uint32 mantissa = half & 0x3FF;
+    if (exponent == 0) {
+        float value = ldexp((float)mantissa, -24);
+        return sign ? -value : value;
+    }
+    Uint32 bits = (exponent == 31) ? (sign | 0x7F800000 | (mantissa << 13))
+                                   : (sign | ((Uint32)(exponent - 15 + 127) << 23) | (mantissa << 13));
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+const Uint8 BAYER_8X8[64] = {
+     0, 32,  8, 40,  2, 34, 10, 42,
+    48, 16, 56, 24, 50, 18, 58, 26,
+    12, 44,  4, 36, 14, 46,  6, 38,
+    60, 28, 52, 20, 62, 30, 54, 22,
+     3, 35, 11, 43,  1, 33,  9, 41,
+    51, 19, 59, 27, 49, 17, 57, 25,
+    15, 47,  7, 39, 13, 45,  5, 37,
+    63, 31, 55, 23, 61, 29, 53, 21
+};
+
+/*
+    Builds the blue noise matrix with the void-and-cluster method (Ulichney, 1993)
+    Every pixel gets an "energy": the sum of a Gaussian around each of the pixels that are on
+    (wrapping around the edges, so the matrix tiles without seams). High energy = tight cluster,
+    low energy = big empty space (void).
+        Step 1: Start from a few random pixels and move the pixel in the tightest cluster into the
+                largest void until that doesn't change anything (the points are evenly spread).
+        Step 2: Rank those pixels by taking them out again, tightest cluster first.
+        Step 3: Rank the rest by filling the largest void, one pixel at a time.
+    Pixels that are turned on early are always far apart, so any threshold gives an even pattern.
+    The ranks are scaled from 0..count-1 to 0..254, a threshold of 255 would overflow a white pixel.
+*/
+vector<Uint8> buildBlueNoise() {
+    const int size = BLUE_NOISE_SIZE;
+    const int count = size * size;
+    vector<Uint8> matrix(count); // rank of each pixel, scaled to 0 to 254
+    const float sigma = 1.5f;
+
+    // Gaussian weight for every (wrapped) offset between two pixels
+    vector<float> weights(count);
+    for (int dy = 0; dy < size; dy++) {
+        for (int dx = 0; dx < size; dx++) {
+            int wx = min(dx, size - dx);
+            int wy = min(dy, size - dy);
+            weights[dy * size + dx] = exp(-(wx * wx + wy * wy) / (2 * sigma * sigma));
+        }
+    }
+
+    vector<char> pattern(count, 0);
+    vector<float> energy(count, 0.0f);
+    auto toggle = [&](vector<char>& bits, vector<float>& field, int index, bool on) {
+        bits[index] = on;
+        int x = index % size, y = index / size;
+        for (int j = 0; j < count; j++) {
+            int dx = (j % size - x + size) % size;
+            int dy = (j / size - y + size) % size;
+            field[j] += on ? weights[dy * size + dx] : -weights[dy * size + dx];
+        }
+    };
+    auto tightestCluster = [&](const vector<char>& bits, const vector<float>& field) {
+        int best = -1;
+        for (int j = 0; j < count; j++) {
+            if (bits[j] && (best < 0 || field[j] > field[best])) best = j;
+        }
+        return best;
+    };
+    auto largestVoid = [&](const vector<char>& bits, const vector<float>& field) {
+        int best = -1;
+        for (int j = 0; j < count; j++) {
+            if (!bits[j] && (best < 0 || field[j] < field[best])) best = j;
+        }
+        return best;
+    };
+
+    // Step 1: Random starting points (fixed seed, so the matrix is the same every run)
+    int ones = 0;
+    Uint32 seed = 12345;
+    while (ones < count / 10) {
+        seed = seed * 1664525 + 1013904223;
+        int index = (seed >> 8) % count;
+        if (pattern[index]) continue;
+        toggle(pattern, energy, index, true);
+        ones++;
+    }
+    for (int iteration = 0; iteration < count; iteration++) {
+        int cluster = tightestCluster(pattern, energy);
+        toggle(pattern, energy, cluster, false);
+        int emptiest = largestVoid(pattern, energy);
+        toggle(pattern, energy, emptiest, true);
+        if (emptiest == cluster) break;
+    }
+
+    // Step 2: Rank the starting points
+    vector<char> bits = pattern;
+    vector<float> field = energy;
+    for (int rank = ones - 1; rank >= 0; rank--) {
+        int cluster = tightestCluster(bits, field);
+        toggle(bits, field, cluster, false);
+        matrix[cluster] = (Uint8)(rank * 255 / count);
+    }
+
+    // Step 3: Rank everything else
+    for (int rank = ones; rank < count; rank++) {
+        int emptiest = largestVoid(pattern, energy);
+        toggle(pattern, energy, emptiest, true);
+        matrix[emptiest] = (Uint8)(rank * 255 / count);
+    }
+    return matrix;
+}
+
+// The blue noise matrix, built the first time it's needed
+const Uint8* blueNoise() {
+    static const vector<Uint8> matrix = buildBlueNoise();
+    return matrix.data();
+}
+
+/*
+    Thresholds for one row of the image: threshold[x] for pixel x is row[x & mask]
+    Returns NULL for DITHER_NONE.
+*/
+const Uint8* ditherRow(DitherMode mode, int y, int& mask, Uint8* scratch) {
+    if (mode == DITHER_BAYER) {
+        // Spread the 64 Bayer levels over 0 to 255
+        for (int x = 0; x < 8; x++) scratch[x] = BAYER_8X8[(y & 7) * 8 + x] * 4 + 2;
+        mask = 7;
+        return scratch;
+    }
+    if (mode == DITHER_BLUE_NOISE) {
+        mask = BLUE_NOISE_SIZE - 1;
+        return blueNoise() + (y & (BLUE_NOISE_SIZE - 1)) * BLUE_NOISE_SIZE;
+    }
+    return NULL;
+}
+
+RetainedScene createRetainedScene(int width, int height, int tileSize, Uint32 clearColor) {
+    tileSize = max(tileSize, 1); // 0 would divide by zero, a negative size would give a negative grid
+    RetainedScene scene;
+    scene.width = width;
+    scene.height = height;
+    scene.tileSize = tileSize;
+    scene.cols = (width + tileSize - 1) / tileSize;
+    scene.rows = (height + tileSize - 1) / tileSize;
+    scene.clearColor = clearColor;
+    scene.bins.resize((size_t)scene.cols * scene.rows);
+    scene.dirty.assign((size_t)scene.cols * scene.rows, true); // nothing has been drawn yet
+    return scene;
+}
+
+// Redraw everything next time (e.g. something else drew over the screen)
+void invalidateRetained(RetainedScene& scene) {
+    fill(scene.dirty.begin(), scene.dirty.end(), true);
+}
+
+/*
+    Adds or removes a triangle's ID in every tile its bounding box overlaps, and marks those tiles dirty
+    Bins stay sorted by ID, so each tile draws its triangles in the same order a full redraw would.
+*/
+void retainedUpdateBins(RetainedScene& scene, Uint32 id, bool add) {
+    const RetainedTriangle& t = scene.triangles[id];
+    if (t.maxX < 0 || t.maxY < 0) return; // completely off the top or left of the screen
+    int firstCol = max(t.minX / scene.tileSize, 0);
+    int lastCol = min(t.maxX / scene.tileSize, scene.cols - 1);
+    int firstRow = max(t.minY / scene.tileSize, 0);
+    int lastRow = min(t.maxY / scene.tileSize, scene.rows - 1);
+
+    for (int row = firstRow; row <= lastRow; row++) {
+        for (int col = firstCol; col <= lastCol; col++) {
+            size_t tile = (size_t)row * scene.cols + col;
+            vector<Uint32>& bin = scene.bins[tile];
+            vector<Uint32>::iterator it = lower_bound(bin.begin(), bin.end(), id);
+            if (add) {
+                bin.insert(it, id);
+            } else if (it != bin.end() && *it == id) {
+                bin.erase(it);
+            }
+            scene.dirty[tile] = true;
+        }
+    }
+}
+
+void retainedSetTriangle(RetainedTriangle& t, Vertex v0, Vertex v1, Vertex v2) {
+    t.v[0] = v0;
+    t.v[1] = v1;
+    t.v[2] = v2;
+    t.minX = min(v0.x, min(v1.x, v2.x));
+    t.maxX = max(v0.x, max(v1.x, v2.x));
+    t.minY = min(v0.y, min(v1.y, v2.y));
+    t.maxY = max(v0.y, max(v1.y, v2.y));
+}
+
+// Adds a triangle and returns its ID. Later triangles are drawn on top of earlier ones.
+Uint32 retainedAdd(RetainedScene& scene, Vertex v0, Vertex v1, Vertex v2) {
+    RetainedTriangle t;
+    retainedSetTriangle(t, v0, v1, v2);
+    t.alive = true;
+    scene.triangles.push_back(t);
+    Uint32 id = (Uint32)scene.triangles.size() - 1;
+    retainedUpdateBins(scene, id, true);
+    return id;
+}
+
+// Moves (or recolors) a triangle: the tiles under its old and new bounds get redrawn
+void retainedUpdate(RetainedScene& scene, Uint32 id, Vertex v0, Vertex v1, Vertex v2) {
+    if (id >= scene.triangles.size() || !scene.triangles[id].alive) return;
+    retainedUpdateBins(scene, id, false);
+    retainedSetTriangle(scene.triangles[id], v0, v1, v2);
+    retainedUpdateBins(scene, id, true);
+}
+
+void retainedRemove(RetainedScene& scene, Uint32 id) {
+    if (id >= scene.triangles.size() || !scene.triangles[id].alive) return;
+    retainedUpdateBins(scene, id, false);
+    scene.triangles[id].alive = false;
+}
+
+/*
+    Redraws the dirty tiles of a retained scene
+    Each dirty tile is drawn through its own copy of the Screen with a scissor around the tile,
+    so fillTriangle() only writes the tile's pixels. The tiles don't overlap, so they are split
+    between threads. Returns how many tiles were redrawn.
+*/
+int renderRetained(Screen& screen, RetainedScene& scene) {
+    FrameArenaScope arenaScope; // the scratch memory below is freed on return
+
+    // A different screen size means the tiles don't line up anymore
+    if (screen.width != scene.width || screen.height != scene.height) {
+        RetainedScene resized = createRetainedScene(screen.width, screen.height, scene.tileSize, scene.clearColor);
+        resized.triangles = scene.triangles;
+        scene = resized;
+        for (Uint32 id = 0; id < scene.triangles.size(); id++) {
+            if (scene.triangles[id].alive) retainedUpdateBins(scene, id, true);
+        }
+        invalidateRetained(scene);
+    }
+
+    FrameVector<int> dirtyTiles;
+    for (size_t tile = 0; tile < scene.dirty.size(); tile++) {
+        if (scene.dirty[tile]) dirtyTiles.push_back((int)tile);
+    }
+
+    parallelRows((int)dirtyTiles.size(), [&](int first, int last) {
+        Screen tileScreen = screen;
+        tileScreen.viewport = {0, 0, screen.width, screen.height};
+        tileScreen.scissorEnabled = true;
+        tileScreen.stencilState.enabled = false;
+
+        for (int i = first; i < last; i++) {
+            int tile = dirtyTiles[i];
+            int x0 = (tile % scene.cols) * scene.tileSize;
+            int y0 = (tile / scene.cols) * scene.tileSize;
+            int x1 = min(x0 + scene.tileSize, screen.width);
+            int y1 = min(y0 + scene.tileSize, screen.height);
+            tileScreen.scissor = {x0, y0, x1 - x0, y1 - y0};
+
+            // Step 1: Clear the tile
+            for (int y = y0; y < y1; y++) {
+                rasterKernels().fillRow(screen.pixels + y * screen.width + x0, x1 - x0, scene.clearColor);
+            }
+
+            // Step 2: Draw the triangles binned to it
+            for (Uint32 id : scene.bins[tile]) {
+                const RetainedTriangle& t = scene.triangles[id];
+                fillTriangle(tileScreen, t.v[0], t.v[1], t.v[2]);
+            }
+        }
+    });
+
+    fill(scene.dirty.begin(), scene.dirty.end(), false);
+    return (int)dirtyTiles.size();
+}
+
+Mat4 identityMatrix() {
+    Mat4 result = {{{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}, {0, 0, 0, 1}}};
+    return result;
+}
+
+Mat4 multiply(const Mat4& a, const Mat4& b) {
+    Mat4 result;
+    for (int row = 0; row < 4; row++) {
+        for (int col = 0; col < 4; col++) {
+            result.m[row][col] = a.m[row][0] * b.m[0][col] + a.m[row][1] * b.m[1][col]
+                               + a.m[row][2] * b.m[2][col] + a.m[row][3] * b.m[3][col];
+        }
+    }
+    return result;
+}
+
+Mat4 translationMatrix(float x, float y, float z) {
+    Mat4 result = identityMatrix();
+    result.m[0][3] = x;
+    result.m[1][3] = y;
+    result.m[2][3] = z;
+    return result;
+}
+
+Mat4 scaleMatrix(float x, float y, float z) {
+    Mat4 result = identityMatrix();
+    result.m[0][0] = x;
+    result.m[1][1] = y;
+    result.m[2][2] = z;
+    return result;
+}
+
+// Rotation around the y (up) axis, angle in radians
+Mat4 rotationYMatrix(float angle) {
+    Mat4 result = identityMatrix();
+    result.m[0][0] = cos(angle);
+    result.m[0][2] = sin(angle);
+    result.m[2][0] = -sin(angle);
+    result.m[2][2] = cos(angle);
+    return result;
+}
+
+/*
+    Perspective projection (camera looks down -z)
+    fovY: vertical field of view in radians, aspect: width / height
+    Points between the near and far planes end up with a depth between -1 (near) and 1 (far) after dividing by w.
+*/
+Mat4 perspectiveMatrix(float fovY, float aspect, float nearZ, float farZ) {
+    float f = 1.0f / tan(fovY / 2);
+    Mat4 result = {{{0}}};
+    result.m[0][0] = f / aspect;
+    result.m[1][1] = f;
+    result.m[2][2] = (farZ + nearZ) / (nearZ - farZ);
+    result.m[2][3] = 2 * farZ * nearZ / (nearZ - farZ);
+    result.m[3][2] = -1;
+    return result;
+}
+
+// Camera at eye looking at target (up is the world's up direction, usually (0, 1, 0))
+Mat4 lookAtMatrix(Vec3 eye, Vec3 target, Vec3 up) {
+    // Camera axes: forward (f), right (r), and the camera's own up (u)
+    Vec3 f = {target.x - eye.x, target.y - eye.y, target.z - eye.z};
+    float length = sqrt(f.x * f.x + f.y * f.y + f.z * f.z);
+    f.x /= length; f.y /= length; f.z /= length;
+
+    Vec3 r = {f.y * up.z - f.z * up.y, f.z * up.x - f.x * up.z, f.x * up.y - f.y * up.x};
+    length = sqrt(r.x * r.x + r.y * r.y + r.z * r.z);
+    r.x /= length; r.y /= length; r.z /= length;
+
+    Vec3 u = {r.y * f.z - r.z * f.y, r.z * f.x - r.x * f.z, r.x * f.y - r.y * f.x};
+
+    Mat4 result = {{
+        {r.x, r.y, r.z, -(r.x * eye.x + r.y * eye.y + r.z * eye.z)},
+        {u.x, u.y, u.z, -(u.x * eye.x + u.y * eye.y + u.z * eye.z)},
+        {-f.x, -f.y, -f.z, (f.x * eye.x + f.y * eye.y + f.z * eye.z)},
+        {0, 0, 0, 1}
+    }};
+    return result;
+}
+
+// Box around a list of points
+AABB pointsBounds(const vector<Vec3>& points) {
+    AABB box = {{1e30f, 1e30f, 1e30f}, {-1e30f, -1e30f, -1e30f}};
+    for (const Vec3& p : points) {
+        box.min.x = min(box.min.x, p.x); box.max.x = max(box.max.x, p.x);
+        box.min.y = min(box.min.y, p.y); box.max.y = max(box.max.y, p.y);
+        box.min.z = min(box.min.z, p.z); box.max.z = max(box.max.z, p.z);
+    }
+    return box;
+}
+
+void computeMeshBounds(Mesh& mesh) {
+    AABB box = pointsBounds(mesh.positions);
+    mesh.bounds = box;
+
+    // Sphere around the box's center (not the tightest sphere, but cheap and never too small)
+    mesh.sphereCenter.x = (box.min.x + box.max.x) / 2;
+    mesh.sphereCenter.y = (box.min.y + box.max.y) / 2;
+    mesh.sphereCenter.z = (box.min.z + box.max.z) / 2;
+    float radius2 = 0;
+    for (const Vec3& p : mesh.positions) {
+        float dx = p.x - mesh.sphereCenter.x;
+        float dy = p.y - mesh.sphereCenter.y;
+        float dz = p.z - mesh.sphereCenter.z;
+        radius2 = max(radius2, dx * dx + dy * dy + dz * dz);
+    }
+    mesh.sphereRadius = sqrt(radius2);
+}
+
+// Box that contains a box after it has been transformed (e.g. a mesh's bounds in world space)
+AABB transformAABB(const Mat4& matrix, const AABB& box) {
+    AABB result = {{1e30f, 1e30f, 1e30f}, {-1e30f, -1e30f, -1e30f}};
+    for (int corner = 0; corner < 8; corner++) {
+        float x = (corner & 1) ? box.max.x : box.min.x;
+        float y = (corner & 2) ? box.max.y : box.min.y;
+        float z = (corner & 4) ? box.max.z : box.min.z;
+        float tx = matrix.m[0][0] * x + matrix.m[0][1] * y + matrix.m[0][2] * z + matrix.m[0][3];
+        float ty = matrix.m[1][0] * x + matrix.m[1][1] * y + matrix.m[1][2] * z + matrix.m[1][3];
+        float tz = matrix.m[2][0] * x + matrix.m[2][1] * y + matrix.m[2][2] * z + matrix.m[2][3];
+        result.min.x = min(result.min.x, tx); result.max.x = max(result.max.x, tx);
+        result.min.y = min(result.min.y, ty); result.max.y = max(result.max.y, ty);
+        result.min.z = min(result.min.z, tz); result.max.z = max(result.max.z, tz);
+    }
+    return result;
+}
+
+/*
+    Transforms a position to a screen space vertex
+    Returns false if the point is behind the camera (w too small to divide by).
+    Screen coordinates are relative to the viewport, since fillTriangle() adds the viewport's corner.
+*/
+bool projectVertex(const Screen& screen, const Mat4& mvp, Vec3 p, Uint32 color, Vertex& out) {
+    float cx = mvp.m[0][0] * p.x + mvp.m[0][1] * p.y + mvp.m[0][2] * p.z + mvp.m[0][3];
+    float cy = mvp.m[1][0] * p.x + mvp.m[1][1] * p.y + mvp.m[1][2] * p.z + mvp.m[1][3];
+    float cz = mvp.m[2][0] * p.x + mvp.m[2][1] * p.y + mvp.m[2][2] * p.z + mvp.m[2][3];
+    float cw = mvp.m[3][0] * p.x + mvp.m[3][1] * p.y + mvp.m[3][2] * p.z + mvp.m[3][3];
+    if (cw < 1e-5f) return false;
+
+    // Perspective divide, then map -1..1 to the viewport (y flipped, screen y goes down)
+    float nx = cx / cw;
+    float ny = cy / cw;
+    out.x = (int)floor((nx * 0.5f + 0.5f) * screen.viewport.width);
+    out.y = (int)floor((0.5f - ny * 0.5f) * screen.viewport.height);
+    out.z = (cz / cw) * 0.5f + 0.5f; // 0 (near) to 1 (far)
+    out.color = color;
+    return true;
+}
+
+/*
+    Draws a mesh with fillTriangle()
+    Triangles with a vertex behind the camera are skipped rather than clipped.
+*/
+void drawMesh(Screen& screen, const Mesh& mesh, const Mat4& mvp) {
+    FrameArenaScope arenaScope; // the scratch memory below is freed on return
+
+    FrameVector<Vertex> projected(mesh.positions.size());
+    FrameVector<char> valid(mesh.positions.size());
+    for (size_t i = 0; i < mesh.positions.size(); i++) {
+        valid[i] = projectVertex(screen, mvp, mesh.positions[i], mesh.colors[i], projected[i]);
+    }
+    for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3) {
+        int a = mesh.indices[t], b = mesh.indices[t + 1], c = mesh.indices[t + 2];
+        if (!valid[a] || !valid[b] || !valid[c]) continue;
+        fillTriangle(screen, projected[a], projected[b], projected[c]);
+    }
+}
+
+void clearInstances(InstanceStream& instances) {
+    instances.count = 0;
+    for (int i = 0; i < 12; i++) instances.m[i].clear();
+    instances.colors.clear();
+}
+
+void addInstance(InstanceStream& instances, const Mat4& transform, Uint32 color) {
+    for (int i = 0; i < 12; i++) {
+        instances.m[i].push_back(transform.m[i / 4][i % 4]);
+    }
+    instances.colors.push_back(color);
+    instances.count++;
+}
+
+// Multiplies two colors channel by channel (0xFFFFFFFF leaves a color as it is)
+Uint32 tintColor(Uint32 color, Uint32 tint) {
+    if (tint == 0xFFFFFFFF) return color;
+    Uint32 result = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        Uint32 value = (((color >> shift) & 0xFF) * ((tint >> shift) & 0xFF) + 127) / 255;
+        result |= value << shift;
+    }
+    return result;
+}
+
+/*
+    True if the box is completely on the outside of one of the clip planes (-w <= x, y, z <= w)
+    after transforming it with mvp, so nothing inside it can show up on the screen
+*/
+bool boxOutsideClip(const Mat4& mvp, const AABB& box) {
+    int outside = 63; // one bit per plane, cleared as soon as a corner is on the inside of it
+    for (int corner = 0; corner < 8; corner++) {
+        float x = (corner & 1) ? box.max.x : box.min.x;
+        float y = (corner & 2) ? box.max.y : box.min.y;
+        float z = (corner & 4) ? box.max.z : box.min.z;
+        float cx = mvp.m[0][0] * x + mvp.m[0][1] * y + mvp.m[0][2] * z + mvp.m[0][3];
+        float cy = mvp.m[1][0] * x + mvp.m[1][1] * y + mvp.m[1][2] * z + mvp.m[1][3];
+        float cz = mvp.m[2][0] * x + mvp.m[2][1] * y + mvp.m[2][2] * z + mvp.m[2][3];
+        float cw = mvp.m[3][0] * x + mvp.m[3][1] * y + mvp.m[3][2] * z + mvp.m[3][3];
+        outside &= (cx < -cw) | (cx > cw) << 1 | (cy < -cw) << 2 | (cy > cw) << 3 | (cz < -cw) << 4 | (cz > cw) << 5;
+    }
+    return outside != 0;
+}
+
+/*
+    Draws every instance of a mesh
+    What doesn't depend on the instance is done once per call:
+        - the mesh's bounding box, so an instance that is off screen (or behind the near plane or
+          past the far plane, like drawScene() culls) costs 8 corner transforms instead of
+          projecting every vertex
+        - the list of triangles (index triples, with out of range indices dropped) and of the
+          vertices they use, so vertices no triangle refers to are never projected
+        - the scratch buffers, from the frame arena, so drawing thousands of instances doesn't call malloc
+    Per visible instance, the vertices are tinted (skipped for white, and only redone when the color
+    changes from the previous instance), projected with viewProj * transform (cheap to build since the
+    transform's last row is known) and the triangles filled, so it costs about as much as drawMesh().
+*/
+void drawInstanced(Screen& screen, const Mesh& mesh, const Mat4& viewProj, const InstanceStream& instances) {
+    FrameArenaScope arenaScope; // the scratch memory below is freed on return
+
+    // Step 1: The triangles and the vertices they use
+    int numVertices = (int)mesh.positions.size();
+    FrameVector<int> triangles;
+    FrameVector<char> used(numVertices, 0);
+    for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3) {
+        int a = mesh.indices[t], b = mesh.indices[t + 1], c = mesh.indices[t + 2];
+        if (a < 0 || b < 0 || c < 0 || a >= numVertices || b >= numVertices || c >= numVertices) continue;
+        triangles.push_back(a);
+        triangles.push_back(b);
+        triangles.push_back(c);
+        used[a] = used[b] = used[c] = 1;
+    }
+    FrameVector<int> usedVertices;
+    for (int i = 0; i < numVertices; i++) {
+        if (used[i]) usedVertices.push_back(i);
+    }
+    if (triangles.empty()) return;
+
+    FrameVector<Vertex> projected(numVertices);
+    FrameVector<char> valid(numVertices);
+    FrameVector<Uint32> tinted(numVertices);
+    Uint32 tintedWith = 0xFFFFFFFF; // white instances never use tinted[], so this means "not filled yet"
+    AABB box = pointsBounds(mesh.positions); // not mesh.bounds, which is only set by computeMeshBounds()
+
+    for (int instance = 0; instance < instances.count; instance++) {
+        // Step 2: mvp = viewProj * transform, where transform's 4th row is 0 0 0 1
+        Mat4 mvp;
+        for (int row = 0; row < 4; row++) {
+            for (int col = 0; col < 4; col++) {
+                float sum = viewProj.m[row][0] * instances.m[col][instance]
+                          + viewProj.m[row][1] * instances.m[4 + col][instance]
+                          + viewProj.m[row][2] * instances.m[8 + col][instance];
+                if (col == 3) sum += viewProj.m[row][3];
+                mvp.m[row][col] = sum;
+            }
+        }
+
+        // Step 3: Skip the instance if it can't be seen
+        if (boxOutsideClip(mvp, box)) continue;
+
+        // Step 4: The vertex colors, tinted with the instance's color
+        Uint32 tint = instances.colors[instance];
+        const Uint32* colors = mesh.colors.data();
+        if (tint != 0xFFFFFFFF) {
+            if (tint != tintedWith) {
+                for (int i : usedVertices) tinted[i] = tintColor(mesh.colors[i], tint);
+                tintedWith = tint;
+            }
+            colors = tinted.data();
+        }
+
+        // Step 5: Project the vertices and fill the triangles (same as drawMesh())
+        for (int i : usedVertices) {
+            valid[i] = projectVertex(screen, mvp, mesh.positions[i], colors[i], projected[i]);
+        }
+        for (size_t t = 0; t < triangles.size(); t += 3) {
+            int a = triangles[t], b = triangles[t + 1], c = triangles[t + 2];
+            if (!valid[a] || !valid[b] || !valid[c]) continue;
+            fillTriangle(screen, projected[a], projected[b], projected[c]);
+        }
+    }
+}
+
+PackedMesh packMesh(const Mesh& mesh) {
+    PackedMesh packed;
+    packed.bounds = pointsBounds(mesh.positions); // not mesh.bounds, which is only set by computeMeshBounds()
+    packed.colors = mesh.colors;
+
+    const float* minimum = &packed.bounds.min.x;
+    const float* maximum = &packed.bounds.max.x;
+    packed.positions.reserve(mesh.positions.size() * 3);
+    for (const Vec3& p : mesh.positions) {
+        const float* coords = &p.x;
+        for (int axis = 0; axis < 3; axis++) {
+            float size = maximum[axis] - minimum[axis];
+            float t = (size > 0) ? (coords[axis] - minimum[axis]) / size : 0.0f;
+            int q = (int)floor(t * 65535 + 0.5f);
+            packed.positions.push_back((Uint16)max(0, min(q, 65535)));
+        }
+    }
+
+    if (mesh.positions.size() <= 65536) {
+        packed.indices16.assign(mesh.indices.begin(), mesh.indices.end());
+    } else {
+        packed.indices32.assign(mesh.indices.begin(), mesh.indices.end());
+    }
+    return packed;
+}
+
+// Turns quantized positions (0 to 65535) back into the mesh's own coordinates
+Mat4 dequantizeMatrix(const PackedMesh& packed) {
+    const AABB& box = packed.bounds;
+    Mat4 scale = scaleMatrix((box.max.x - box.min.x) / 65535,
+                             (box.max.y - box.min.y) / 65535,
+                             (box.max.z - box.min.z) / 65535);
+    return multiply(translationMatrix(box.min.x, box.min.y, box.min.z), scale);
+}
+
+// Same as drawMesh(), for a packed mesh
+void drawPackedMesh(Screen& screen, const PackedMesh& packed, const Mat4& mvp) {
+    FrameArenaScope arenaScope; // the scratch memory below is freed on return
+
+    Mat4 matrix = multiply(mvp, dequantizeMatrix(packed));
+    size_t numVertices = packed.colors.size();
+    FrameVector<Vertex> projected(numVertices);
+    FrameVector<char> valid(numVertices);
+
+    const Uint16* q = packed.positions.data();
+    for (size_t i = 0; i < numVertices; i++) {
+        Vec3 p = {(float)q[i * 3], (float)q[i * 3 + 1], (float)q[i * 3 + 2]};
+        valid[i] = projectVertex(screen, matrix, p, packed.colors[i], projected[i]);
+    }
+
+    if (!packed.indices16.empty()) {
+        fillPackedTriangles(screen, packed.indices16, projected, valid);
+    } else {
+        fillPackedTriangles(screen, packed.indices32, projected, valid);
+    }
+}
+
+Quadric planeQuadric(double a, double b, double c, double d) {
+    Quadric result = {{a * a, a * b, a * c, a * d, b * b, b * c, b * d, c * c, c * d, d * d}};
+    return result;
+}
+
+void addQuadric(Quadric& to, const Quadric& from) {
+    for (int i = 0; i < 10; i++) to.q[i] += from.q[i];
+}
+
+// Squared distance (summed over all planes in the quadric) of a point
+double quadricError(const Quadric& quadric, Vec3 p) {
+    const double* q = quadric.q;
+    double x = p.x, y = p.y, z = p.z;
+    return q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x
+         + q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y
+         + q[7] * z * z + 2 * q[8] * z
+         + q[9];
+}
+
+Vec3 faceNormal(Vec3 a, Vec3 b, Vec3 c) {
+    Vec3 e1 = {b.x - a.x, b.y - a.y, b.z - a.z};
+    Vec3 e2 = {c.x - a.x, c.y - a.y, c.z - a.z};
+    Vec3 n = {e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z, e1.x * e2.y - e1.y * e2.x};
+    return n;
+}
+
+/*
+    Makes a simpler version of a mesh with at most targetTriangles triangles (if it can get there)
+    The merged vertex is placed at one of the edge's two ends (whichever has less error), so every
+    vertex of the simplified mesh is an original vertex and keeps its color.
+*/
+Mesh simplifyMesh(const Mesh& mesh, int targetTriangles) {
+    int numVertices = (int)mesh.positions.size();
+    int numTriangles = (int)mesh.indices.size() / 3;
+    vector<int> triangles(mesh.indices.begin(), mesh.indices.begin() + numTriangles * 3);
+    vector<bool> triangleAlive(numTriangles, true);
+    vector<bool> vertexAlive(numVertices, true);
+    vector<int> version(numVertices, 0);
+    vector<vector<int> > vertexTriangles(numVertices);
+    Quadric zero = {{0}};
+    vector<Quadric> quadrics(numVertices, zero);
+
+    // Step 1: Quadric of each vertex = sum of the planes of the triangles around it
+    for (int t = 0; t < numTriangles; t++) {
+        int a = triangles[t * 3], b = triangles[t * 3 + 1], c = triangles[t * 3 + 2];
+        Vec3 n = faceNormal(mesh.positions[a], mesh.positions[b], mesh.positions[c]);
+        double length = sqrt((double)n.x * n.x + (double)n.y * n.y + (double)n.z * n.z);
+        if (length > 0) {
+            double nx = n.x / length, ny = n.y / length, nz = n.z / length;
+            double d = -(nx * mesh.positions[a].x + ny * mesh.positions[a].y + nz * mesh.positions[a].z);
+            Quadric plane = planeQuadric(nx, ny, nz, d);
+            addQuadric(quadrics[a], plane);
+            addQuadric(quadrics[b], plane);
+            addQuadric(quadrics[c], plane);
+        }
+        vertexTriangles[a].push_back(t);
+        vertexTriangles[b].push_back(t);
+        vertexTriangles[c].push_back(t);
+    }
+
+    // Cheapest way to collapse edge a-b: a into b, or b into a
+    priority_queue<EdgeCollapse, vector<EdgeCollapse>, greater<EdgeCollapse> > queue;
+    auto pushEdge = [&](int a, int b) {
+        Quadric sum = quadrics[a];
+        addQuadric(sum, quadrics[b]);
+        double costAtA = quadricError(sum, mesh.positions[a]);
+        double costAtB = quadricError(sum, mesh.positions[b]);
+        EdgeCollapse collapse;
+        if (costAtB <= costAtA) {
+            collapse.cost = costAtB; collapse.from = a; collapse.to = b;
+        } else {
+            collapse.cost = costAtA; collapse.from = b; collapse.to = a;
+        }
+        collapse.fromVersion = version[collapse.from];
+        collapse.toVersion = version[collapse.to];
+        queue.push(collapse);
+    };
+
+    // Step 2: Queue every edge once
+    set<pair<int, int> > edges;
+    for (int t = 0; t < numTriangles; t++) {
+        for (int i = 0; i < 3; i++) {
+            int a = triangles[t * 3 + i], b = triangles[t * 3 + (i + 1) % 3];
+            edges.insert(make_pair(min(a, b), max(a, b)));
+        }
+    }
+    for (const pair<int, int>& edge : edges) {
+        pushEdge(edge.first, edge.second);
+    }
+
+    // Step 3: Collapse the cheapest edge until there are few enough triangles
+    int aliveTriangles = numTriangles;
+    while (aliveTriangles > targetTriangles && !queue.empty()) {
+        EdgeCollapse collapse = queue.top();
+        queue.pop();
+        int from = collapse.from, to = collapse.to;
+        // Outdated entry (one of the vertices was collapsed or changed since)
+        if (!vertexAlive[from] || !vertexAlive[to]) continue;
+        if (collapse.fromVersion != version[from] || collapse.toVersion != version[to]) continue;
+
+        // Don't collapse if a triangle that survives would flip over (its normal turns around)
+        bool flips = false;
+        for (int t : vertexTriangles[from]) {
+            if (!triangleAlive[t]) continue;
+            int* tri = &triangles[t * 3];
+            if (tri[0] == to || tri[1] == to || tri[2] == to) continue; // this one disappears
+            Vec3 p[3], moved[3];
+            for (int i = 0; i < 3; i++) {
+                p[i] = mesh.positions[tri[i]];
+                moved[i] = mesh.positions[tri[i] == from ? to : tri[i]];
+            }
+            Vec3 before = faceNormal(p[0], p[1], p[2]);
+            Vec3 after = faceNormal(moved[0], moved[1], moved[2]);
+            if (before.x * after.x + before.y * after.y + before.z * after.z <= 0) {
+                flips = true;
+                break;
+            }
+        }
+        if (flips) continue;
+
+        // Merge: triangles around "from" now use "to", and the ones that had both become lines and go away
+        for (int t : vertexTriangles[from]) {
+            if (!triangleAlive[t]) continue;
+            int* tri = &triangles[t * 3];
+            if (tri[0] == to || tri[1] == to || tri[2] == to) {
+                triangleAlive[t] = false;
+                aliveTriangles--;
+                continue;
+            }
+            for (int i = 0; i < 3; i++) {
+                if (tri[i] == from) tri[i] = to;
+            }
+            vertexTriangles[to].push_back(t);
+        }
+        vertexAlive[from] = false;
+        vertexTriangles[from].clear();
+        addQuadric(quadrics[to], quadrics[from]);
+        version[to]++;
+
+        // Drop dead triangles from the list and queue the edges around "to" again with the new quadric
+        // (the old entries for these edges are now outdated, since version[to] changed)
+        vector<int>& around = vertexTriangles[to];
+        around.erase(remove_if(around.begin(), around.end(), [&](int t) { return !triangleAlive[t]; }), around.end());
+        set<int> neighbors;
+        for (int t : around) {
+            for (int i = 0; i < 3; i++) {
+                if (triangles[t * 3 + i] != to) neighbors.insert(triangles[t * 3 + i]);
+            }
+        }
+        for (int neighbor : neighbors) {
+            pushEdge(to, neighbor);
+        }
+    }
+
+    // Step 4: Build the simplified mesh from the vertices and triangles that are left
+    Mesh result;
+    vector<int> remap(numVertices, -1);
+    for (int t = 0; t < numTriangles; t++) {
+        if (!triangleAlive[t]) continue;
+        for (int i = 0; i < 3; i++) {
+            int v = triangles[t * 3 + i];
+            if (remap[v] < 0) {
+                remap[v] = (int)result.positions.size();
+                result.positions.push_back(mesh.positions[v]);
+                result.colors.push_back(mesh.colors[v]);
+            }
+            result.indices.push_back(remap[v]);
+        }
+    }
+    computeMeshBounds(result);
+    return result;
+}
+
+// How many pixels of screen area a triangle should cover at least (smaller -> pick a simpler level)
+float LOD_PIXELS_PER_TRIANGLE = 16;
+
+MeshLOD buildMeshLOD(const Mesh& mesh, int numLevels) {
+    MeshLOD lod;
+    lod.levels.push_back(mesh);
+    for (int level = 1; level < numLevels; level++) {
+        const Mesh& previous = lod.levels.back();
+        int triangles = (int)previous.indices.size() / 3;
+        if (triangles <= 4) break;
+        Mesh simpler = simplifyMesh(previous, triangles / 2);
+        // Stop if simplifying didn't get anywhere (e.g. every collapse would flip a triangle)
+        if (simpler.indices.size() >= previous.indices.size()) break;
+        lod.levels.push_back(simpler);
+    }
+    return lod;
+}
+
+/*
+    Picks the level for one draw
+    The mesh's bounding sphere is projected to the screen: its radius in pixels is about
+    radius * (matrix scale) * (viewport size / 2) / w. The matrix scale comes from the length of the
+    matrix's first two rows, which includes both the model's scale and the camera's field of view.
+    Then we take the most detailed level that still has at least LOD_PIXELS_PER_TRIANGLE pixels per triangle.
+*/
+int selectLOD(const Screen& screen, const MeshLOD& lod, const Mat4& mvp) {
+    const Mesh& mesh = lod.levels[0];
+    Vec3 c = mesh.sphereCenter;
+    float w = mvp.m[3][0] * c.x + mvp.m[3][1] * c.y + mvp.m[3][2] * c.z + mvp.m[3][3];
+    float scaleX = sqrt(mvp.m[0][0] * mvp.m[0][0] + mvp.m[0][1] * mvp.m[0][1] + mvp.m[0][2] * mvp.m[0][2]);
+    float scaleY = sqrt(mvp.m[1][0] * mvp.m[1][0] + mvp.m[1][1] * mvp.m[1][1] + mvp.m[1][2] * mvp.m[1][2]);
+    float scaleW = sqrt(mvp.m[3][0] * mvp.m[3][0] + mvp.m[3][1] * mvp.m[3][1] + mvp.m[3][2] * mvp.m[3][2]);
+
+    // Camera inside (or very close to) the sphere: full detail
+    if (w <= mesh.sphereRadius * scaleW) return 0;
+
+    float radiusX = mesh.sphereRadius * scaleX * screen.viewport.width / 2 / w;
+    float radiusY = mesh.sphereRadius * scaleY * screen.viewport.height / 2 / w;
+    float radius = max(radiusX, radiusY);
+    float area = 3.14159265f * radius * radius;
+
+    int level = 0;
+    while (level + 1 < (int)lod.levels.size() &&
+           (float)lod.levels[level].indices.size() / 3 * LOD_PIXELS_PER_TRIANGLE > area) {
+        level++;
+    }
+    return level;
+}
+
+// Draws a mesh using the level that fits its size on screen
+void drawMeshLOD(Screen& screen, const MeshLOD& lod, const Mat4& mvp) {
+    drawMesh(screen, lod.levels[selectLOD(screen, lod, mvp)], mvp);
+}
+
+Frustum extractFrustum(const Mat4& viewProj) {
+    Frustum frustum;
+    const float (*m)[4] = viewProj.m;
+    for (int i = 0; i < 4; i++) {
+        frustum.planes[0][i] = m[3][i] + m[0][i]; // left
+        frustum.planes[1][i] = m[3][i] - m[0][i]; // right
+        frustum.planes[2][i] = m[3][i] + m[1][i]; // bottom
+        frustum.planes[3][i] = m[3][i] - m[1][i]; // top
+        frustum.planes[4][i] = m[3][i] + m[2][i]; // near
+        frustum.planes[5][i] = m[3][i] - m[2][i]; // far
+    }
+    return frustum;
+}
+
+void updateObjectBounds(SceneObject& object) {
+    object.worldBounds = transformAABB(object.model, object.mesh->bounds);
+}
+
+// Box around a range of objects
+AABB objectsBounds(const vector<SceneObject>& objects, const vector<int>& ids, int first, int last) {
+    AABB box = {{1e30f, 1e30f, 1e30f}, {-1e30f, -1e30f, -1e30f}};
+    for (int i = first; i < last; i++) {
+        const AABB& b = objects[ids[i]].worldBounds;
+        box.min.x = min(box.min.x, b.min.x); box.max.x = max(box.max.x, b.max.x);
+        box.min.y = min(box.min.y, b.min.y); box.max.y = max(box.max.y, b.max.y);
+        box.min.z = min(box.min.z, b.min.z); box.max.z = max(box.max.z, b.max.z);
+    }
+    return box;
+}
+
+/*
+    Builds the node for objects ids[first..last) and returns its index
+    Up to 4 objects: they go straight into the node. More: sort them along the longest axis of
+    their box and split them into 4 equal groups, each becoming a child node.
+*/
+int buildBVHNode(SceneBVH& bvh, const vector<SceneObject>& objects, vector<int>& ids, int first, int last) {
+    int nodeIndex = (int)bvh.nodes.size();
+    bvh.nodes.push_back(BVHNode());
+
+    int count = last - first;
+    int children[BVH_WIDTH];
+    AABB boxes[BVH_WIDTH];
+    int numChildren = 0;
+
+    if (count <= BVH_WIDTH) {
+        for (int i = first; i < last; i++) {
+            children[numChildren] = -(ids[i] + 1);
+            boxes[numChildren] = objects[ids[i]].worldBounds;
+            numChildren++;
+        }
+    } else {
+        AABB box = objectsBounds(objects, ids, first, last);
+        float sizeX = box.max.x - box.min.x;
+        float sizeY = box.max.y - box.min.y;
+        float sizeZ = box.max.z - box.min.z;
+        int axis = (sizeX >= sizeY && sizeX >= sizeZ) ? 0 : (sizeY >= sizeZ) ? 1 : 2;
+        sort(ids.begin() + first, ids.begin() + last, [&](int a, int b) {
+            const AABB& ba = objects[a].worldBounds;
+            const AABB& bb = objects[b].worldBounds;
+            if (axis == 0) return ba.min.x + ba.max.x < bb.min.x + bb.max.x;
+            if (axis == 1) return ba.min.y + ba.max.y < bb.min.y + bb.max.y;
+            return ba.min.z + ba.max.z < bb.min.z + bb.max.z;
+        });
+
+        for (int group = 0; group < BVH_WIDTH; group++) {
+            int groupFirst = first + count * group / BVH_WIDTH;
+            int groupLast = first + count * (group + 1) / BVH_WIDTH;
+            if (groupFirst == groupLast) continue;
+            boxes[numChildren] = objectsBounds(objects, ids, groupFirst, groupLast);
+            children[numChildren] = buildBVHNode(bvh, objects, ids, groupFirst, groupLast);
+            numChildren++;
+        }
+    }
+
+    // Fill in the node (nodes may have moved while building the children, so index again)
+    BVHNode& node = bvh.nodes[nodeIndex];
+    node.count = numChildren;
+    for (int i = 0; i < BVH_WIDTH; i++) {
+        // Unused slots get an "inside out" box that fails every test
+        bool used = i < numChildren;
+        node.minX[i] = used ? boxes[i].min.x : 1e30f;  node.maxX[i] = used ? boxes[i].max.x : -1e30f;
+        node.minY[i] = used ? boxes[i].min.y : 1e30f;  node.maxY[i] = used ? boxes[i].max.y : -1e30f;
+        node.minZ[i] = used ? boxes[i].min.z : 1e30f;  node.maxZ[i] = used ? boxes[i].max.z : -1e30f;
+        node.child[i] = used ? children[i] : 0;
+    }
+    return nodeIndex;
+}
+
+// Builds the BVH over all objects (call again after objects move)
+SceneBVH buildSceneBVH(const vector<SceneObject>& objects) {
+    SceneBVH bvh;
+    if (objects.empty()) return bvh;
+    vector<int> ids(objects.size());
+    for (size_t i = 0; i < objects.size(); i++) ids[i] = (int)i;
+    buildBVHNode(bvh, objects, ids, 0, (int)objects.size());
+    return bvh;
+}
+
+/*
+    Tests a node's 4 child boxes against the frustum at once
+    For each plane, the box corner furthest along the plane's normal (the "positive vertex") tells us
+    if any of the box is inside, and the opposite corner tells us if all of it is inside.
+    All the arrays are indexed by lane, so every loop over the lanes can run as SIMD.
+*/
+void cullNodeChildren(const BVHNode& node, const Frustum& frustum, CullResult results[BVH_WIDTH]) {
+    bool outside[BVH_WIDTH] = {false, false, false, false};
+    bool intersects[BVH_WIDTH] = {false, false, false, false};
+
+    for (int p = 0; p < 6; p++) {
+        float a = frustum.planes[p][0];
+        float b = frustum.planes[p][1];
+        float c = frustum.planes[p][2];
+        float d = frustum.planes[p][3];
+        for (int i = 0; i < BVH_WIDTH; i++) {
+            float px = (a >= 0) ? node.maxX[i] : node.minX[i];
+            float py = (b >= 0) ? node.maxY[i] : node.minY[i];
+            float pz = (c >= 0) ? node.maxZ[i] : node.minZ[i];
+            float nx = (a >= 0) ? node.minX[i] : node.maxX[i];
+            float ny = (b >= 0) ? node.minY[i] : node.maxY[i];
+            float nz = (c >= 0) ? node.minZ[i] : node.maxZ[i];
+            outside[i] = outside[i] || (a * px + b * py + c * pz + d < 0);
+            intersects[i] = intersects[i] || (a * nx + b * ny + c * nz + d < 0);
+        }
+    }
+
+    for (int i = 0; i < BVH_WIDTH; i++) {
+        bool empty = node.minX[i] > node.maxX[i];
+        results[i] = (outside[i] || empty) ? CULL_OUTSIDE : intersects[i] ? CULL_INTERSECTS : CULL_INSIDE;
+    }
+}
+
+// Adds every object under a node without testing (the node is completely inside the frustum)
+void collectAllObjects(const SceneBVH& bvh, int nodeIndex, vector<int>& visible) {
+    const BVHNode& node = bvh.nodes[nodeIndex];
+    for (int i = 0; i < node.count; i++) {
+        if (node.child[i] < 0) {
+            visible.push_back(-(node.child[i] + 1));
+        } else {
+            collectAllObjects(bvh, node.child[i], visible);
+        }
+    }
+}
+
+// Indices of the objects whose boxes are at least partly inside the frustum
+vector<int> cullScene(const SceneBVH& bvh, const Frustum& frustum) {
+    vector<int> visible;
+    if (bvh.nodes.empty()) return visible;
+
+    vector<int> stack;
+    stack.push_back(0);
+    while (!stack.empty()) {
+        const BVHNode& node = bvh.nodes[stack.back()];
+        stack.pop_back();
+
+        CullResult results[BVH_WIDTH];
+        cullNodeChildren(node, frustum, results);
+        for (int i = 0; i < node.count; i++) {
+            if (results[i] == CULL_OUTSIDE) continue;
+            if (node.child[i] < 0) {
+                visible.push_back(-(node.child[i] + 1));
+            } else if (results[i] == CULL_INSIDE) {
+                collectAllObjects(bvh, node.child[i], visible);
+            } else {
+                stack.push_back(node.child[i]);
+            }
+        }
+    }
+    return visible;
+}
+
+/*
+    Draws a scene: culls against the view frustum first, so objects that are off screen are never
+    transformed or set up, then draws the remaining objects' meshes.
+*/
+void drawScene(Screen& screen, const vector<SceneObject>& objects, const SceneBVH& bvh, const Mat4& viewProj) {
+    vector<int> visible = cullScene(bvh, extractFrustum(viewProj));
+    for (int id : visible) {
+        const SceneObject& object = objects[id];
+        Mat4 mvp = multiply(viewProj, object.model);
+        if (object.lod) {
+            drawMeshLOD(screen, *object.lod, mvp);
+        } else {
+            drawMesh(screen, *object.mesh, mvp);
+        }
+    }
+}
+
+StaticBinCache createStaticBinCache() {
+    StaticBinCache cache;
+    cache.valid = false;
+    return cache;
+}
+
+// Forget the static bins (e.g. a static object's mesh was edited in place)
+void invalidateStaticBins(StaticBinCache& cache) {
+    cache.valid = false;
+}
+
+bool sameMatrix(const Mat4& a, const Mat4& b) {
+    for (int row = 0; row < 4; row++) {
+        for (int col = 0; col < 4; col++) {
+            if (a.m[row][col] != b.m[row][col]) return false;
+        }
+    }
+    return true;
+}
+
+// Are the cached static bins still right for this frame?
+bool staticBinsValid(const StaticBinCache& cache, const Screen& screen, const vector<SceneObject>& objects,
+                     const Mat4& viewProj, int tileSize) {
+    if (!cache.valid) return false;
+    if (cache.width != screen.width || cache.height != screen.height || cache.tileSize != tileSize) return false;
+    if (!sameMatrix(cache.viewProj, viewProj)) return false;
+    if (cache.meshes.size() != objects.size()) return false;
+    for (size_t i = 0; i < objects.size(); i++) {
+        if (cache.meshes[i] != objects[i].mesh || !sameMatrix(cache.models[i], objects[i].model)) return false;
+    }
+    return true;
+}
+
+/*
+    Draws a whole frame: every tile is cleared, then the static objects are drawn, then the dynamic ones
+    Returns true if the static bins came from the cache. Tiles are at least 1 x 1 pixel.
+*/
+bool renderTiled(Screen& screen, StaticBinCache& cache, const vector<SceneObject>& staticObjects,
+                 const vector<SceneObject>& dynamicObjects, const Mat4& viewProj, int tileSize, Uint32 clearColor) {
+    FrameArenaScope arenaScope; // the scratch memory below is freed on return
+    tileSize = max(tileSize, 1); // same as createRetainedScene()
+
+    Screen fullScreen = screen;
+    fullScreen.viewport = {0, 0, screen.width, screen.height};
+    fullScreen.scissorEnabled = true;
+    fullScreen.stencilState.enabled = false;
+
+    // Step 1: Bin the static objects, unless the cache still has them
+    bool cached = staticBinsValid(cache, fullScreen, staticObjects, viewProj, tileSize);
+    if (!cached) {
+        binObjects(fullScreen, staticObjects, viewProj, tileSize, cache.bins);
+        cache.valid = true;
+        cache.width = screen.width;
+        cache.height = screen.height;
+        cache.tileSize = tileSize;
+        cache.viewProj = viewProj;
+        cache.meshes.clear();
+        cache.models.clear();
+        for (const SceneObject& object : staticObjects) {
+            cache.meshes.push_back(object.mesh);
+            cache.models.push_back(object.model);
+        }
+    }
+
+    // Step 2: Bin the dynamic objects
+    FrameTileBins dynamicBins;
+    binObjects(fullScreen, dynamicObjects, viewProj, tileSize, dynamicBins);
+
+    // Step 3: Draw the tiles
+    int cols = (screen.width + tileSize - 1) / tileSize;
+    int numTiles = (int)cache.bins.bins.size();
+    parallelRows(numTiles, [&](int first, int last) {
+        Screen tileScreen = fullScreen;
+        for (int tile = first; tile < last; tile++) {
+            int x0 = (tile % cols) * tileSize;
+            int y0 = (tile / cols) * tileSize;
+            int x1 = min(x0 + tileSize, screen.width);
+            int y1 = min(y0 + tileSize, screen.height);
+            tileScreen.scissor = {x0, y0, x1 - x0, y1 - y0};
+
+            for (int y = y0; y < y1; y++) {
+                rasterKernels().fillRow(screen.pixels + y * screen.width + x0, x1 - x0, clearColor);
+            }
+
+            drawTileBin(tileScreen, cache.bins, tile);
+            drawTileBin(tileScreen, dynamicBins, tile);
+        }
+    });
+    return cached;
+}
+
+} // namespace rast
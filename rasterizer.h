@@ -0,0 +1,1221 @@
+/*
+    Rasterizer core
+    Everything that draws into a Screen (or a Framebuffer, Mesh, ...) lives here, built as a library
+    (librasterizer) so other programs can render without starting the triangle_rasterizer program.
+    The core never calls SDL. A Screen still has the window, renderer and texture pointers, so the
+    frontend (triangle_rasterizer.cpp) can show it, but the core only needs to know those types exist.
+    Everything is in namespace rast (the SDL-compatible integer typedefs below stay global).
+    How each function works is explained next to it in rasterizer.cpp.
+    For a plain C interface (other languages, stable ABI) see rasterizer_c.h.
+*/
+#ifndef RASTERIZER_H
+#define RASTERIZER_H
+
+#include <cstdint>
+#include <iostream>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <climits>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <algorithm>
+#include <set>
+#include <unordered_map>
+#include <queue>
+
+// SDL's integer types (the same typedefs as SDL3/SDL_stdinc.h, so both headers can be included together)
+typedef uint8_t Uint8;
+typedef uint16_t Uint16;
+typedef uint32_t Uint32;
+typedef uint64_t Uint64;
+
+// Only created by the frontend, offscreen screens leave them NULL
+struct SDL_Window;
+struct SDL_Renderer;
+struct SDL_Texture;
+
+namespace rast {
+
+// A rectangle of pixels, used for the scissor and viewport
+struct ClipRect {
+    int x;      // left column
+    int y;      // top row
+    int width;
+    int height;
+};
+
+// How the value in the stencil buffer is compared against the reference value
+enum StencilFunc {
+    STENCIL_ALWAYS,     // always passes
+    STENCIL_EQUAL,      // passes if stencil == ref
+    STENCIL_NOT_EQUAL,  // passes if stencil != ref
+    STENCIL_GREATER_EQUAL // passes if stencil >= ref
+};
+
+// What happens to the value in the stencil buffer when the test passes
+enum StencilOp {
+    STENCIL_KEEP,       // leave it alone
+    STENCIL_ZERO,       // set it to 0
+    STENCIL_REPLACE,    // set it to ref
+    STENCIL_INCREMENT,  // add 1 (stops at 255)
+    STENCIL_DECREMENT   // subtract 1 (stops at 0)
+};
+
+struct StencilState {
+    bool enabled;
+    StencilFunc func;
+    Uint8 ref;
+    StencilOp passOp;
+    bool writeColor;    // false = only update the stencil buffer (used to draw masks)
+};
+
+struct Screen {
+    SDL_Window* window;
+    SDL_Renderer* renderer;
+    SDL_Texture* texture;
+    int width;
+    int height;
+    Uint32* pixels; // the pixel buffer (1D array), stores RGBA color (format: 0xRRGGBBAA)
+    Uint8* stencil; // one 8-bit stencil value per pixel, same layout as pixels
+
+    /*
+        Render state (see resetRenderState())
+        - viewport: vertex coordinates are relative to the viewport's top-left corner,
+                    and nothing is drawn outside of it
+        - scissor: when enabled, nothing is drawn outside of this rectangle
+        - stencilState: per-pixel test against the stencil buffer
+        - linearColor: interpolate and blend colors in linear light (see interpolateColorLinear())
+    */
+    ClipRect viewport;
+    bool scissorEnabled;
+    ClipRect scissor;
+    StencilState stencilState;
+    bool linearColor;
+};
+
+struct Vertex {
+    int x;
+    int y;
+    Uint32 color;
+    float z;    // depth, only used by the visibility buffer (smaller = closer, defaults to 0)
+};
+
+void clearStencil(Screen& screen, Uint8 value);
+void resetRenderState(Screen& screen);
+void setPixel(Screen& screen, int x, int y, Uint32 color);
+ClipRect clipRect(const Screen& screen);
+bool stencilPass(Screen& screen, int index);
+void parallelRows(int height, const std::function<void(int, int)>& work);
+void stopRowWorkers();
+
+/*
+    Frame arena
+    A lot of what we allocate only lives for one frame (edge lists, projected vertices, tile bins...).
+    Getting each of those from malloc costs time, and threads allocating at the same time fight over
+    malloc's locks. A frame arena is one big block of memory per thread: allocating just moves an offset
+    forward ("bump allocation"), nothing is freed on its own, and resetFrameArena() at the end of the
+    frame makes the whole block free again.
+    If a frame needs more than the block has, more blocks are added, and the next reset replaces them all
+    with one block big enough for everything, so after the first few frames there are no mallocs at all.
+    Anything allocated from it must not be used after the reset.
+    The drawing functions that use it internally give their memory back before they return (see
+    FrameArenaScope), so a program that never calls resetFrameArena() doesn't grow it without limit.
+    Only FrameVectors the program creates itself (or gets back, like from bresenham()) stay until the reset.
+*/
+const size_t FRAME_ARENA_BLOCK_SIZE = 1 << 20;  // first block: 1 MB
+const size_t FRAME_ARENA_ALIGN = 16;            // every allocation starts on a 16 byte boundary
+
+struct FrameArena {
+    std::vector<std::vector<char>> blocks;    // allocating from the last one
+    size_t offset;                  // how much of the last block is used
+};
+
+FrameArena& frameArena();
+void* arenaAllocate(FrameArena& arena, size_t bytes);
+void resetFrameArena();
+
+/*
+    Remembers how much of the calling thread's arena is used, and frees everything allocated after
+    that when it goes out of scope. Nothing allocated while it exists may be used afterwards.
+*/
+struct FrameArenaScope {
+    FrameArena& arena;
+    size_t blocks;  // arena.blocks.size() and arena.offset when the scope was opened
+    size_t offset;
+
+    FrameArenaScope();
+    ~FrameArenaScope();
+    FrameArenaScope(const FrameArenaScope&) = delete;
+    FrameArenaScope& operator=(const FrameArenaScope&) = delete;
+};
+
+/*
+    Lets STL containers use the frame arena, e.g. FrameVector<Vertex> instead of vector<Vertex>
+    The allocator remembers the arena of the thread that created it, so a container keeps using the
+    same arena even if it's filled from another thread. deallocate() does nothing, the memory comes
+    back at the next resetFrameArena().
+*/
+template <class T>
+struct ArenaAllocator {
+    typedef T value_type;
+    FrameArena* arena;
+
+    ArenaAllocator() : arena(&frameArena()) {}
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t n) { return (T*)arenaAllocate(*arena, n * sizeof(T)); }
+    void deallocate(T*, size_t) {}
+};
+
+template <class T, class U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena == b.arena; }
+template <class T, class U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena != b.arena; }
+
+template <class T>
+using FrameVector = std::vector<T, ArenaAllocator<T>>;
+
+Uint32 interpolateColor(Uint32 color0, Uint32 color1, float t);
+/*
+    Gamma-correct (linear light) color math
+    Colors are stored in sRGB, which spends more of its 256 levels on dark shades (because our
+    eyes are more sensitive to them). So halfway between 0 and 255 in sRGB is not half as bright,
+    and interpolating the stored values makes gradients too dark in the middle.
+    For correct results the colors are converted to linear light, mixed there, and converted back.
+    The exact formulas use pow(), which is far too slow per pixel, so both directions are lookup tables:
+        - toLinear: 8 bit sRGB -> 12 bit linear (256 entries, 512 bytes)
+        - toSrgb: 12 bit linear -> 8 bit sRGB (4096 entries, 4 KB)
+    12 bits are needed in linear because the dark sRGB levels are very close together there.
+    Both tables fit in the L1 cache. Alpha is not gamma encoded, so it's mixed as it is.
+    Drawing functions use this when screen.linearColor is on (see resetRenderState()).
+*/
+struct SrgbTables {
+    Uint16 toLinear[256];
+    Uint8 toSrgb[4096];
+};
+
+SrgbTables buildSrgbTables();
+const SrgbTables& srgbTables();
+Uint32 interpolateColorLinear(Uint32 color0, Uint32 color1, float t);
+
+// Picks the gamma-correct or the plain version
+inline Uint32 mixColor(Uint32 color0, Uint32 color1, float t, bool linear) {
+    return linear ? interpolateColorLinear(color0, color1, t) : interpolateColor(color0, color1, t);
+}
+
+FrameVector<Vertex> bresenhamLow(int x0, int y0, Uint32 color0, 
+                                 int x1, int y1, Uint32 color1);
+FrameVector<Vertex> bresenhamHigh(int x0, int y0, Uint32 color0, 
+                                  int x1, int y1, Uint32 color1);
+FrameVector<Vertex> bresenham(int x0, int y0, Uint32 color0, 
+                              int x1, int y1, Uint32 color1);
+void drawTriangle(Screen& screen, Vertex v0, Vertex v1, Vertex v2);
+void fillSpan(Screen& screen, int y, int x_first, int x_last,
+              int x_left, int x_right, Uint32 color_left, Uint32 color_right);
+
+/*
+    CPU-specific kernels
+    The innermost loops (filling rows, gradients, format conversion, edge evaluation) are compiled
+    several times, once per instruction set (SSE2, AVX2, AVX-512), from the same source. The compiler
+    vectorizes each copy as wide as that instruction set allows, so one binary runs everywhere and
+    still uses the wide registers where the CPU has them.
+    The first time anything draws, the best set the CPU supports is picked (see selectRasterKernels()),
+    and every caller goes through rasterKernels(), whose name says which set it is. Set the environment variable RAST_ISA (sse2, avx2 or avx512) to force
+    a set, e.g. to compare them or to test the narrower ones on a new machine.
+    All sets produce exactly the same pixels, only the speed differs.
+*/
+struct EdgeEquation;
+
+struct RasterKernels {
+    const char* name;
+
+    // Sets count pixels to one color (clears, single color spans)
+    void (*fillRow)(Uint32* row, int count, Uint32 color);
+
+    // The gradient loops of fillSpan(), plain and in linear light (no stencil test)
+    void (*gradientSpan)(Uint32* row, int x_first, int x_last, int x_left, int x_right,
+                         Uint32 color_left, Uint32 color_right);
+    void (*linearGradientSpan)(Uint32* row, int x_first, int x_last, int x_left, int x_right,
+                               Uint32 color_left, Uint32 color_right);
+
+    // RGBA8888 -> RGB565, with dithering when thresholds isn't NULL (see ditherPixels())
+    void (*convertToRGB565)(const Uint32* source, Uint16* destination, int width,
+                            const Uint8* thresholds, int mask);
+
+    // The three edge equations at pixels x_first..x_first + count - 1 of row y
+    void (*evaluateEdges)(const EdgeEquation* edges, int y, int x_first, int count,
+                          float* d0, float* d1, float* d2);
+
+    // Set bits in count words, and bits set in both a[i] and b[i] (coverage mask areas)
+    Uint64 (*countBits)(const Uint64* words, size_t count);
+    Uint64 (*countCommonBits)(const Uint64* a, const Uint64* b, size_t count);
+};
+
+const RasterKernels& rasterKernels();
+void setRasterKernels(const RasterKernels& kernels); // e.g. to compare the sets, not while drawing
+std::vector<const RasterKernels*> supportedRasterKernels();
+const RasterKernels* findRasterKernels(const char* name);
+const RasterKernels* selectRasterKernels();
+
+/*
+    One edge of a triangle, set up for the scanline loop
+    The endpoints are sorted so top is above bottom (top.y <= bottom.y) and already
+    moved into the viewport. Triangles in a strip or fan share edges with their neighbors,
+    so each edge is set up once and handed to both triangles (see fillTriangleStrip()).
+*/
+struct TriangleEdge {
+    Vertex top;
+    Vertex bottom;
+    int height; // bottom.y - top.y (0 for a flat edge)
+};
+
+TriangleEdge setupEdge(Vertex a, Vertex b);
+TriangleEdge setupEdge(const Screen& screen, Vertex a, Vertex b);
+void edgeAt(const TriangleEdge& edge, int y, float& x, Uint32& color, bool linear = false);
+float edgeX(const TriangleEdge& edge, int y);
+void orderTriangleEdges(const TriangleEdge& e0, const TriangleEdge& e1, const TriangleEdge& e2,
+                        const TriangleEdge*& longEdge, const TriangleEdge*& topEdge, const TriangleEdge*& bottomEdge);
+bool triangleSpan(const TriangleEdge& longEdge, const TriangleEdge& topEdge, const TriangleEdge& bottomEdge,
+                  int y, int& x_left, int& x_right, Uint32& color_left, Uint32& color_right, bool linear = false);
+void fillTriangleEdges(Screen& screen, const TriangleEdge& e0, const TriangleEdge& e1, const TriangleEdge& e2);
+void fillTriangle(Screen& screen, Vertex v0, Vertex v1, Vertex v2);
+bool isCollinear(Vertex v0, Vertex v1, Vertex v2);
+void fillTriangleStrip(Screen& screen, const std::vector<Vertex>& vertices);
+void fillTriangleFan(Screen& screen, const std::vector<Vertex>& vertices);
+void fillConvexPolygon(Screen& screen, const std::vector<Vertex>& vertices);
+
+/*
+    Coverage mask: 1 bit per pixel instead of a 32-bit color
+    For hit testing and masks we only need to know which pixels a triangle covers.
+    Packing 64 pixels into one 64-bit word uses 32 times less memory than the color buffer,
+    and a whole run of covered pixels can be set with a few word writes instead of one write per pixel.
+    Bit (x % 64) of word (x / 64) in a row is pixel x. Rows are padded to a whole number of words.
+*/
+struct CoverageMask {
+    int width;
+    int height;
+    int wordsPerRow;
+    std::vector<Uint64> bits;
+};
+
+CoverageMask createCoverageMask(int width, int height);
+void clearCoverageMask(CoverageMask& mask);
+Uint64 bitRange(int first, int last);
+void setMaskSpan(Uint64* row, int x_first, int x_last);
+void rasterizeCoverage(CoverageMask& mask, Vertex v0, Vertex v1, Vertex v2);
+bool maskTest(const CoverageMask& mask, int x, int y);
+Uint64 maskArea(const CoverageMask& mask);
+Uint64 maskArea(const CoverageMask& mask, ClipRect rect);
+Uint64 maskOverlapArea(const CoverageMask& a, const CoverageMask& b);
+
+/*
+    Visibility buffer
+    With fillTriangle(), a pixel covered by 10 overlapping triangles is colored 10 times and
+    only the last color survives. A visibility buffer splits drawing into two passes:
+        1. Rasterize: for each pixel, store only the ID of the nearest triangle and its depth
+        2. Shade: for each pixel, look up its triangle and work out the color once
+    So no matter how many triangles overlap, each visible pixel is shaded exactly once.
+    Triangle IDs are indexes into the list of triangles given to shadeVisibility().
+*/
+const Uint32 VISIBILITY_EMPTY = 0xFFFFFFFF; // no triangle covers this pixel
+
+struct VisibilityBuffer {
+    int width;
+    int height;
+    std::vector<Uint32> ids;    // triangle ID per pixel
+    std::vector<float> depth;   // depth of that triangle at the pixel (smaller = closer)
+};
+
+VisibilityBuffer createVisibilityBuffer(int width, int height);
+void clearVisibilityBuffer(VisibilityBuffer& buffer);
+float edgeDepth(const TriangleEdge& edge, int y);
+void rasterizeVisibility(VisibilityBuffer& buffer, Vertex v0, Vertex v1, Vertex v2, Uint32 id);
+void shadeVisibility(Screen& screen, const VisibilityBuffer& buffer, const std::vector<std::vector<Vertex>>& triangles);
+
+/*
+    Occlusion culling
+    In a scene where a few big walls hide most objects, drawing everything wastes most of the work.
+    Before drawing, the big "occluder" triangles are rasterized into a small depth-only buffer
+    (e.g. 256 x 128, much smaller than the screen). Then, for each object, we look at the part
+    of the buffer under its screen bounding box: if every cell there has an occluder in front of
+    the object's nearest point, the object is completely hidden and its draw can be skipped.
+
+    The buffer must never claim an object is hidden when part of it is visible, so everything
+    is rounded in the "not hidden" direction:
+        - occluders only cover the low resolution pixels they cover completely
+        - each occluder is stored at the depth of its farthest vertex
+        - the object's bounding box is grown to whole low resolution pixels
+*/
+struct OcclusionBuffer {
+    int width;
+    int height;
+    float scaleX;           // occlusion buffer pixels per screen pixel
+    float scaleY;
+    std::vector<float> depth;    // nearest occluder depth per pixel (1e30 = nothing there)
+};
+
+// The screen space box an object covers, and the depth of its nearest point
+struct ScreenBounds {
+    int minX;
+    int minY;
+    int maxX;
+    int maxY;
+    float minZ;
+};
+
+OcclusionBuffer createOcclusionBuffer(int width, int height, int screenWidth, int screenHeight);
+void clearOcclusionBuffer(OcclusionBuffer& buffer);
+void rasterizeOccluder(OcclusionBuffer& buffer, Vertex v0, Vertex v1, Vertex v2);
+bool isOccluded(const OcclusionBuffer& buffer, const ScreenBounds& bounds);
+ScreenBounds triangleBounds(const std::vector<std::vector<Vertex>>& triangles);
+
+/*
+    Picking: "which triangle is under the cursor?"
+    We could rasterize a visibility buffer and read the ID back, but that redraws everything for
+    every query. Instead the screen is divided into a grid of cells, and each cell keeps a list of the
+    triangles whose bounding box overlaps it. A point query only tests the few triangles in one cell,
+    and moving a triangle only updates the cells it left and entered.
+*/
+const Uint32 PICK_NONE = 0xFFFFFFFF; // no triangle at that point
+
+struct PickTriangle {
+    Vertex v[3];
+    int minX, minY, maxX, maxY;     // bounding box
+    bool alive;                     // false once removed (IDs are never reused)
+};
+
+struct PickIndex {
+    int width;                      // size of the screen being picked from
+    int height;
+    int cellSize;                   // cells are cellSize x cellSize pixels (at least 1)
+    int cols;
+    int rows;
+    std::vector<PickTriangle> triangles; // indexed by triangle ID
+    std::vector<std::vector<Uint32>> cells;   // IDs of the triangles overlapping each cell
+};
+
+PickIndex createPickIndex(int width, int height, int cellSize);
+bool pointInTriangle(Vertex v0, Vertex v1, Vertex v2, int x, int y);
+bool triangleOverlapsRect(const PickTriangle& t, ClipRect rect);
+void pickUpdateCells(PickIndex& index, Uint32 id, bool add);
+void pickSetTriangle(PickTriangle& t, Vertex v0, Vertex v1, Vertex v2);
+Uint32 pickAdd(PickIndex& index, Vertex v0, Vertex v1, Vertex v2);
+void pickUpdate(PickIndex& index, Uint32 id, Vertex v0, Vertex v1, Vertex v2);
+void pickRemove(PickIndex& index, Uint32 id);
+Uint32 pickPoint(const PickIndex& index, int x, int y);
+std::vector<Uint32> pickRect(const PickIndex& index, ClipRect rect);
+
+/*
+    Edge equations (used by the anti-aliased rasterizer)
+    Each edge of the triangle is written as a line equation: E(x, y) = a*x + b*y + c
+        - E > 0: the point is on the inside of the edge
+        - E = 0: the point is exactly on the edge
+        - E < 0: the point is on the outside of the edge
+    A pixel is inside the triangle when it is on the inside of all three edges.
+    If the equation is divided by sqrt(a*a + b*b), E becomes the signed distance (in pixels)
+    from the point to the edge, which is what we use to estimate how much of a pixel is covered.
+*/
+struct EdgeEquation {
+    float a;
+    float b;
+    float c;
+};
+
+float setupEdgeEquations(Vertex v0, Vertex v1, Vertex v2, EdgeEquation edges[3]);
+bool edgeSpan(const EdgeEquation edges[3], const float thresholds[3], float y,
+              int& x_left, int& x_right);
+Uint32 barycentricColor(Uint32 c0, Uint32 c1, Uint32 c2, float w0, float w1, float w2, bool linear = false);
+void fillTriangleAA(Screen& screen, Vertex v0, Vertex v1, Vertex v2);
+void expandEdgesConservative(EdgeEquation edges[3]);
+void fillTriangleConservative(Screen& screen, Vertex v0, Vertex v1, Vertex v2);
+
+// A point on a path. Unlike Vertex, paths use floats so curves flattened into lines keep their sub-pixel precision.
+struct PathPoint {
+    float x;
+    float y;
+};
+
+/*
+    Fill rules decide which parts of a path are "inside" when its contours overlap or wind around more than once.
+    Walk from the left edge of the screen towards a pixel and count the path edges you cross:
+        - FILL_EVEN_ODD: inside if you crossed an odd number of edges (overlaps and nested contours become holes)
+        - FILL_NON_ZERO: +1 for edges going down, -1 for edges going up, inside if the total is not 0
+                         (nested contours are only holes if they go around the other way)
+*/
+enum FillRule {
+    FILL_EVEN_ODD,
+    FILL_NON_ZERO
+};
+
+// One edge of a path, stored with its top endpoint first (for the edge table)
+struct PathEdge {
+    float y_top;
+    float y_bottom;
+    float x_top;    // x at y_top
+    float slope;    // change in x per 1 change in y
+    int winding;    // +1 if the edge goes down, -1 if it goes up
+    float x;        // x where the edge crosses the current sample row (updated while scanning)
+};
+
+// Number of sample rows per pixel row when anti-aliasing paths (horizontal coverage is computed exactly)
+const int PATH_AA_SAMPLES = 4;
+
+void fillPath(Screen& screen, const std::vector<std::vector<PathPoint>>& contours, Uint32 color,
+              FillRule rule, bool antiAliasing);
+std::vector<int> triangulatePolygon(const std::vector<Vertex>& polygon);
+
+/*
+    Cache of polygon triangulations, so static shapes are only triangulated once
+    The key is a hash of the polygon's positions (colors don't change the triangles).
+    Hash collisions are handled by also storing the positions and comparing them.
+*/
+struct CachedTriangulation {
+    std::vector<int> positions;  // x0, y0, x1, y1, ...
+    std::vector<int> indices;
+};
+
+struct TriangulationCache {
+    std::unordered_map<Uint64, std::vector<CachedTriangulation>> entries;
+};
+
+Uint64 hashPolygon(const std::vector<Vertex>& polygon);
+const std::vector<int>& triangulateCached(TriangulationCache& cache, const std::vector<Vertex>& polygon);
+void fillPolygon(Screen& screen, TriangulationCache& cache, const std::vector<Vertex>& polygon);
+/*
+    Largest screen createOffscreen() accepts, in pixels (width * height)
+    Pixels are indexed with int (y * width + x), so this has to stay well below INT_MAX.
+*/
+const size_t MAX_SCREEN_PIXELS = (size_t)1 << 28;
+
+bool validScreenSize(int width, int height);
+Screen createOffscreen(int width, int height);
+void destroyOffscreen(Screen& screen);
+void downsampleRows(const Screen& src, Screen& dst, int factor, int yStart, int yEnd);
+void renderSupersampled(Screen& screen, const std::vector<std::vector<Vertex>>& triangles, int factor);
+/*
+    Framebuffers in other pixel formats
+    Screen always stores RGBA8888 (32 bits per pixel), which is what SDL shows. A Framebuffer can
+    store its pixels in a different format:
+        - RGBA8888: same as Screen
+        - RGB565: 16 bits, 5 bits red, 6 green, 5 blue (half the memory traffic, no alpha)
+        - Indexed8: 8 bits, an index into a fixed 256 color palette (RGB332: 3 bits red, 3 green, 2 blue)
+        - RGBA16F: 4 half floats (HDR, 64 bits)
+        - RGBA32F: 4 floats (HDR, 128 bits)
+    Each format is a struct with its Pixel type and encode()/decode() to and from RGBA8888.
+    fillTriangle() works on any Framebuffer, with a span kernel per format, and
+    copyToScreen() converts a Framebuffer to the Screen's format so it can be shown.
+    (Framebuffers have no viewport, scissor or stencil, triangles are only clipped to the edges.)
+*/
+Uint16 floatToHalf(float value);
+float halfToFloat(Uint16 half);
+
+struct FormatRGBA8888 {
+    typedef Uint32 Pixel;
+    static Pixel encode(Uint32 color) { return color; }
+    static Uint32 decode(Pixel pixel) { return pixel; }
+};
+
+struct FormatRGB565 {
+    typedef Uint16 Pixel;
+    static Pixel encode(Uint32 color) {
+        return (Pixel)(((color >> 16) & 0xF800) | ((color >> 13) & 0x07E0) | ((color >> 11) & 0x001F));
+    }
+    // threshold: 0 to 254, from a dither pattern (see ditherPixels())
+    static Pixel encodeDithered(Uint32 color, Uint32 threshold) {
+        Uint32 r = (((color >> 24) & 0xFF) * 31 + threshold) / 255;
+        Uint32 g = (((color >> 16) & 0xFF) * 63 + threshold) / 255;
+        Uint32 b = (((color >> 8) & 0xFF) * 31 + threshold) / 255;
+        return (Pixel)((r << 11) | (g << 5) | b);
+    }
+    static Uint32 decode(Pixel pixel) {
+        // Repeat the top bits in the bottom ones, so 31 -> 255 (not 248)
+        Uint32 r = (pixel >> 11) & 0x1F;
+        Uint32 g = (pixel >> 5) & 0x3F;
+        Uint32 b = pixel & 0x1F;
+        r = (r << 3) | (r >> 2);
+        g = (g << 2) | (g >> 4);
+        b = (b << 3) | (b >> 2);
+        return (r << 24) | (g << 16) | (b << 8) | 0xFF;
+    }
+};
+
+struct FormatIndexed8 {
+    typedef Uint8 Pixel;
+    static Pixel encode(Uint32 color) {
+        // Nearest palette level on each channel (7 levels of red and green, 3 of blue above 0)
+        return encodeDithered(color, 127);
+    }
+    static Pixel encodeDithered(Uint32 color, Uint32 threshold) {
+        Uint32 r = (((color >> 24) & 0xFF) * 7 + threshold) / 255;
+        Uint32 g = (((color >> 16) & 0xFF) * 7 + threshold) / 255;
+        Uint32 b = (((color >> 8) & 0xFF) * 3 + threshold) / 255;
+        return (Pixel)((r << 5) | (g << 2) | b);
+    }
+    static Uint32 decode(Pixel pixel) {
+        return palette()[pixel];
+    }
+
+    // The 256 colors (RGB332), built the first time it's needed
+    // (C++11 initializes a function's static once even if several threads get there at the same time)
+    static const Uint32* palette() {
+        static const std::vector<Uint32> colors = buildPalette();
+        return colors.data();
+    }
+    static std::vector<Uint32> buildPalette() {
+        std::vector<Uint32> colors(256);
+        for (int i = 0; i < 256; i++) {
+            Uint32 r = (i >> 5) & 7, g = (i >> 2) & 7, b = i & 3;
+            colors[i] = ((r * 255 / 7) << 24) | ((g * 255 / 7) << 16) | ((b * 255 / 3) << 8) | 0xFF;
+        }
+        return colors;
+    }
+};
+
+struct PixelRGBA16F {
+    Uint16 r, g, b, a;
+};
+
+struct PixelRGBA32F {
+    float r, g, b, a;
+};
+
+// 8 bit channel -> float (0 to 1) and back (clamped, since HDR values can go above 1)
+inline float channelToFloat(Uint32 color, int shift) {
+    return ((color >> shift) & 0xFF) * (1.0f / 255);
+}
+
+inline Uint32 floatToChannel(float value, int shift) {
+    float scaled = value * 255 + 0.5f;
+    int channel = (scaled <= 0) ? 0 : (scaled >= 255) ? 255 : (int)scaled;
+    return (Uint32)channel << shift;
+}
+
+struct FormatRGBA16F {
+    typedef PixelRGBA16F Pixel;
+    static Pixel encode(Uint32 color) {
+        Pixel pixel = {floatToHalf(channelToFloat(color, 24)), floatToHalf(channelToFloat(color, 16)),
+                       floatToHalf(channelToFloat(color, 8)), floatToHalf(channelToFloat(color, 0))};
+        return pixel;
+    }
+    static Uint32 decode(Pixel pixel) {
+        return floatToChannel(halfToFloat(pixel.r), 24) | floatToChannel(halfToFloat(pixel.g), 16)
+             | floatToChannel(halfToFloat(pixel.b), 8) | floatToChannel(halfToFloat(pixel.a), 0);
+    }
+};
+
+struct FormatRGBA32F {
+    typedef PixelRGBA32F Pixel;
+    static Pixel encode(Uint32 color) {
+        Pixel pixel = {channelToFloat(color, 24), channelToFloat(color, 16),
+                       channelToFloat(color, 8), channelToFloat(color, 0)};
+        return pixel;
+    }
+    static Uint32 decode(Pixel pixel) {
+        return floatToChannel(pixel.r, 24) | floatToChannel(pixel.g, 16)
+             | floatToChannel(pixel.b, 8) | floatToChannel(pixel.a, 0);
+    }
+};
+
+template <class Format>
+struct Framebuffer {
+    int width;
+    int height;
+    std::vector<typename Format::Pixel> pixels;
+};
+
+template <class Format>
+Framebuffer<Format> createFramebuffer(int width, int height) {
+    Framebuffer<Format> framebuffer;
+    framebuffer.width = width;
+    framebuffer.height = height;
+    framebuffer.pixels.assign((size_t)width * height, Format::encode(0x000000FF));
+    return framebuffer;
+}
+
+template <class Format>
+void clearFramebuffer(Framebuffer<Format>& framebuffer, Uint32 color) {
+    std::fill(framebuffer.pixels.begin(), framebuffer.pixels.end(), Format::encode(color));
+}
+
+/*
+    Span kernel: fills pixels x_first..x_last of a row, same as fillSpan() does for the Screen
+    By default the color is worked out in RGBA8888 and then encoded, the specializations below
+    skip steps their format doesn't need.
+*/
+template <class Format>
+void fillFramebufferSpan(typename Format::Pixel* row, int x_first, int x_last,
+                         int x_left, int x_right, Uint32 color_left, Uint32 color_right) {
+    if (x_right == x_left) {
+        typename Format::Pixel pixel = Format::encode(color_left);
+        for (int x = x_first; x <= x_last; x++) row[x] = pixel;
+        return;
+    }
+    for (int x = x_first; x <= x_last; x++) {
+        float t_span = (float)(x - x_left) / (float)(x_right - x_left);
+        row[x] = Format::encode(interpolateColor(color_left, color_right, t_span));
+    }
+}
+
+// Float pixels: interpolate in float, no rounding to 8 bits in between
+template <>
+inline void fillFramebufferSpan<FormatRGBA32F>(PixelRGBA32F* row, int x_first, int x_last,
+                                        int x_left, int x_right, Uint32 color_left, Uint32 color_right) {
+    PixelRGBA32F left = FormatRGBA32F::encode(color_left);
+    PixelRGBA32F right = FormatRGBA32F::encode(color_right);
+    float width = (x_right == x_left) ? 1.0f : (float)(x_right - x_left);
+    for (int x = x_first; x <= x_last; x++) {
+        float t_span = (float)(x - x_left) / width;
+        row[x].r = left.r + (right.r - left.r) * t_span;
+        row[x].g = left.g + (right.g - left.g) * t_span;
+        row[x].b = left.b + (right.b - left.b) * t_span;
+        row[x].a = left.a + (right.a - left.a) * t_span;
+    }
+}
+
+template <>
+inline void fillFramebufferSpan<FormatRGBA16F>(PixelRGBA16F* row, int x_first, int x_last,
+                                        int x_left, int x_right, Uint32 color_left, Uint32 color_right) {
+    PixelRGBA32F left = FormatRGBA32F::encode(color_left);
+    PixelRGBA32F right = FormatRGBA32F::encode(color_right);
+    float width = (x_right == x_left) ? 1.0f : (float)(x_right - x_left);
+    for (int x = x_first; x <= x_last; x++) {
+        float t_span = (float)(x - x_left) / width;
+        row[x].r = floatToHalf(left.r + (right.r - left.r) * t_span);
+        row[x].g = floatToHalf(left.g + (right.g - left.g) * t_span);
+        row[x].b = floatToHalf(left.b + (right.b - left.b) * t_span);
+        row[x].a = floatToHalf(left.a + (right.a - left.a) * t_span);
+    }
+}
+
+// fillTriangle() for a Framebuffer (coordinates are pixels in the framebuffer)
+template <class Format>
+void fillTriangle(Framebuffer<Format>& framebuffer, Vertex v0, Vertex v1, Vertex v2) {
+    TriangleEdge e0 = setupEdge(v0, v1);
+    TriangleEdge e1 = setupEdge(v1, v2);
+    TriangleEdge e2 = setupEdge(v2, v0);
+    const TriangleEdge* longEdge;
+    const TriangleEdge* topEdge;
+    const TriangleEdge* bottomEdge;
+    orderTriangleEdges(e0, e1, e2, longEdge, topEdge, bottomEdge);
+    if (longEdge->height == 0) return;
+
+    int y_first = std::max(longEdge->top.y, 0);
+    int y_last = std::min(longEdge->bottom.y, framebuffer.height - 1);
+    for (int y = y_first; y <= y_last; y++) {
+        int x_left, x_right;
+        Uint32 color_left, color_right;
+        if (!triangleSpan(*longEdge, *topEdge, *bottomEdge, y, x_left, x_right, color_left, color_right)) continue;
+        int x_first = std::max(x_left, 0);
+        int x_last = std::min(x_right, framebuffer.width - 1);
+        typename Format::Pixel* row = framebuffer.pixels.data() + (size_t)y * framebuffer.width;
+        fillFramebufferSpan<Format>(row, x_first, x_last, x_left, x_right, color_left, color_right);
+    }
+}
+
+/*
+    Converts pixels from one format to another (through RGBA8888)
+    A plain loop over two arrays, so the compiler can vectorize it for the simple formats.
+*/
+template <class From, class To>
+void convertPixels(const typename From::Pixel* source, typename To::Pixel* destination, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        destination[i] = To::encode(From::decode(source[i]));
+    }
+}
+
+// Float to half float doesn't need to go through 8 bits
+template <>
+inline void convertPixels<FormatRGBA32F, FormatRGBA16F>(const PixelRGBA32F* source, PixelRGBA16F* destination, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        destination[i].r = floatToHalf(source[i].r);
+        destination[i].g = floatToHalf(source[i].g);
+        destination[i].b = floatToHalf(source[i].b);
+        destination[i].a = floatToHalf(source[i].a);
+    }
+}
+
+template <>
+inline void convertPixels<FormatRGBA16F, FormatRGBA32F>(const PixelRGBA16F* source, PixelRGBA32F* destination, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        destination[i].r = halfToFloat(source[i].r);
+        destination[i].g = halfToFloat(source[i].g);
+        destination[i].b = halfToFloat(source[i].b);
+        destination[i].a = halfToFloat(source[i].a);
+    }
+}
+
+// RGBA8888 to RGB565 goes through the CPU-specific kernel (see RasterKernels)
+template <>
+inline void convertPixels<FormatRGBA8888, FormatRGB565>(const Uint32* source, Uint16* destination, size_t count) {
+    rasterKernels().convertToRGB565(source, destination, (int)count, NULL, 0);
+}
+
+// Both framebuffers must be the same size
+template <class From, class To>
+void convertFramebuffer(const Framebuffer<From>& source, Framebuffer<To>& destination) {
+    if (source.width != destination.width || source.height != destination.height) {
+        std::cout << "Framebuffer sizes don't match" << std::endl;
+        return;
+    }
+    convertPixels<From, To>(source.pixels.data(), destination.pixels.data(), source.pixels.size());
+}
+
+// Converts a framebuffer into the Screen's pixels (RGBA8888) so updateScreen() can show it
+template <class Format>
+void copyToScreen(const Framebuffer<Format>& framebuffer, Screen& screen) {
+    int width = std::min(framebuffer.width, screen.width);
+    int height = std::min(framebuffer.height, screen.height);
+    parallelRows(height, [&](int yStart, int yEnd) {
+        for (int y = yStart; y < yEnd; y++) {
+            convertPixels<Format, FormatRGBA8888>(framebuffer.pixels.data() + (size_t)y * framebuffer.width,
+                                                  screen.pixels + y * screen.width, width);
+        }
+    });
+}
+
+/*
+    Dithering
+    RGB565 only has 32 levels of red and blue (64 of green), so a smooth gradient turns into visible
+    bands when it's converted. Dithering adds a small, fixed pattern before rounding, so each pixel
+    rounds up or down depending on where it is, and the average over a few pixels is the real color.
+    The pattern is a threshold per pixel (0 to 254), tiled over the image:
+        - DITHER_BAYER: 8x8 ordered (Bayer) matrix, very regular, a bit of a cross-hatch look
+        - DITHER_BLUE_NOISE: 16x16 blue noise, looks like fine grain without any visible structure
+    A channel with levels 0..L is quantized as (value * L + threshold) / 255. With threshold = 127
+    that's plain rounding, and averaged over all the thresholds it's exactly value * L / 255.
+    The threshold has to stay below 255: 255 * L + 255 would round a full channel up to L + 1.
+*/
+enum DitherMode {
+    DITHER_NONE,
+    DITHER_BAYER,
+    DITHER_BLUE_NOISE
+};
+
+extern const Uint8 BAYER_8X8[64];
+
+const int BLUE_NOISE_SIZE = 16;
+
+std::vector<Uint8> buildBlueNoise();
+const Uint8* blueNoise();
+const Uint8* ditherRow(DitherMode mode, int y, int& mask, Uint8* scratch);
+
+/*
+    Converts a row of RGBA8888 pixels to a format with encodeDithered() (RGB565 or Indexed8)
+    Only a table lookup and an add per channel more than the plain conversion.
+*/
+template <class To>
+void ditherPixels(const Uint32* source, typename To::Pixel* destination, int width, int y, DitherMode mode) {
+    Uint8 scratch[8];
+    int mask = 0;
+    const Uint8* thresholds = ditherRow(mode, y, mask, scratch);
+    if (!thresholds) {
+        for (int x = 0; x < width; x++) destination[x] = To::encode(source[x]);
+        return;
+    }
+    for (int x = 0; x < width; x++) {
+        destination[x] = To::encodeDithered(source[x], thresholds[x & mask]);
+    }
+}
+
+// Same for RGB565, through the CPU-specific kernel
+template <>
+inline void ditherPixels<FormatRGB565>(const Uint32* source, Uint16* destination, int width, int y, DitherMode mode) {
+    Uint8 scratch[8];
+    int mask = 0;
+    const Uint8* thresholds = ditherRow(mode, y, mask, scratch);
+    rasterKernels().convertToRGB565(source, destination, width, thresholds, mask);
+}
+
+// Converts the Screen to a smaller format with dithering (both must be the same size)
+template <class To>
+void convertScreenDithered(const Screen& screen, Framebuffer<To>& destination, DitherMode mode) {
+    if (screen.width != destination.width || screen.height != destination.height) {
+        std::cout << "Framebuffer sizes don't match" << std::endl;
+        return;
+    }
+    parallelRows(screen.height, [&](int yStart, int yEnd) {
+        for (int y = yStart; y < yEnd; y++) {
+            ditherPixels<To>(screen.pixels + y * screen.width,
+                             destination.pixels.data() + (size_t)y * destination.width, screen.width, y, mode);
+        }
+    });
+}
+
+// Same, from another framebuffer (converted to RGBA8888 a row at a time first)
+template <class From, class To>
+void convertFramebufferDithered(const Framebuffer<From>& source, Framebuffer<To>& destination, DitherMode mode) {
+    if (source.width != destination.width || source.height != destination.height) {
+        std::cout << "Framebuffer sizes don't match" << std::endl;
+        return;
+    }
+    parallelRows(source.height, [&](int yStart, int yEnd) {
+        std::vector<Uint32> row(source.width);
+        for (int y = yStart; y < yEnd; y++) {
+            convertPixels<From, FormatRGBA8888>(source.pixels.data() + (size_t)y * source.width, row.data(), source.width);
+            ditherPixels<To>(row.data(), destination.pixels.data() + (size_t)y * destination.width, source.width, y, mode);
+        }
+    });
+}
+
+/*
+    Retained scene with incremental re-rendering
+    Normally every frame clears the screen and draws every triangle again, even if only a few moved.
+    A retained scene keeps its triangles between frames, and the screen is divided into tiles
+    (e.g. 64 x 64 pixels), each with a list ("bin") of the triangles that overlap it.
+    When a triangle is added, moved or removed, the tiles under its old and new bounding boxes are
+    marked dirty. renderRetained() then only clears and redraws the dirty tiles, with a scissor
+    rectangle around each one, and the rest of the screen keeps what was drawn last frame.
+    Triangles are in screen coordinates (the viewport is ignored, like the stencil test).
+*/
+struct RetainedTriangle {
+    Vertex v[3];
+    int minX, minY, maxX, maxY;     // bounding box
+    bool alive;                     // false once removed (IDs are never reused)
+};
+
+struct RetainedScene {
+    int width;                          // size of the screen it's drawn to
+    int height;
+    int tileSize;                       // at least 1
+    int cols;
+    int rows;
+    Uint32 clearColor;                  // what a tile is cleared to before redrawing it
+    std::vector<RetainedTriangle> triangles; // indexed by triangle ID
+    std::vector<std::vector<Uint32>> bins;        // IDs of the triangles overlapping each tile, in drawing order
+    std::vector<bool> dirty;                 // tiles that need redrawing
+};
+
+RetainedScene createRetainedScene(int width, int height, int tileSize, Uint32 clearColor);
+void invalidateRetained(RetainedScene& scene);
+void retainedUpdateBins(RetainedScene& scene, Uint32 id, bool add);
+void retainedSetTriangle(RetainedTriangle& t, Vertex v0, Vertex v1, Vertex v2);
+Uint32 retainedAdd(RetainedScene& scene, Vertex v0, Vertex v1, Vertex v2);
+void retainedUpdate(RetainedScene& scene, Uint32 id, Vertex v0, Vertex v1, Vertex v2);
+void retainedRemove(RetainedScene& scene, Uint32 id);
+int renderRetained(Screen& screen, RetainedScene& scene);
+
+/*
+    3D meshes
+    Everything above works on screen space triangles. To draw 3D objects, each mesh vertex goes through
+    a 4x4 matrix (model -> world -> camera -> clip space), gets divided by w (perspective), and is
+    mapped to the viewport, which gives us the screen space Vertex that fillTriangle() already knows how to draw.
+    Matrices are row-major and multiply column vectors: clip = matrix * (x, y, z, 1).
+*/
+struct Vec3 {
+    float x;
+    float y;
+    float z;
+};
+
+struct Mat4 {
+    float m[4][4];
+};
+
+Mat4 identityMatrix();
+Mat4 multiply(const Mat4& a, const Mat4& b);
+Mat4 translationMatrix(float x, float y, float z);
+Mat4 scaleMatrix(float x, float y, float z);
+Mat4 rotationYMatrix(float angle);
+Mat4 perspectiveMatrix(float fovY, float aspect, float nearZ, float farZ);
+Mat4 lookAtMatrix(Vec3 eye, Vec3 target, Vec3 up);
+
+// Axis-aligned bounding box
+struct AABB {
+    Vec3 min;
+    Vec3 max;
+};
+
+/*
+    A triangle mesh: positions and colors per vertex, and 3 indices per triangle
+    The bounds (box and sphere around all positions) are filled in by computeMeshBounds().
+*/
+struct Mesh {
+    std::vector<Vec3> positions;
+    std::vector<Uint32> colors;
+    std::vector<int> indices;
+
+    AABB bounds;
+    Vec3 sphereCenter;
+    float sphereRadius;
+};
+
+AABB pointsBounds(const std::vector<Vec3>& points);
+void computeMeshBounds(Mesh& mesh);
+AABB transformAABB(const Mat4& matrix, const AABB& box);
+bool projectVertex(const Screen& screen, const Mat4& mvp, Vec3 p, Uint32 color, Vertex& out);
+void drawMesh(Screen& screen, const Mesh& mesh, const Mat4& mvp);
+
+/*
+    Instanced drawing
+    Draws the same mesh many times (e.g. thousands of markers), each copy with its own transform and color.
+    The instance data is stored "structure of arrays" style: m[0][i] .. m[11][i] is the 3x4 transform
+    (top 3 rows of a Mat4, the 4th row is always 0 0 0 1) of instance i, and colors[i] its color.
+    That way adding and reading instances walks straight through memory, one array at a time.
+    drawInstanced() culls instances that are outside the view with one box test each, and sets up the
+    triangle list once per call; the visible instances cost about as much as a drawMesh() call each.
+*/
+struct InstanceStream {
+    int count;
+    std::vector<float> m[12];
+    std::vector<Uint32> colors;
+};
+
+void clearInstances(InstanceStream& instances);
+void addInstance(InstanceStream& instances, const Mat4& transform, Uint32 color);
+Uint32 tintColor(Uint32 color, Uint32 tint);
+bool boxOutsideClip(const Mat4& mvp, const AABB& box);
+void drawInstanced(Screen& screen, const Mesh& mesh, const Mat4& viewProj, const InstanceStream& instances);
+
+/*
+    Packed meshes
+    A Mesh vertex is 16 bytes (3 floats + a color), and a big mesh spends most of its drawing time
+    just reading them. A packed mesh stores each position as three 16 bit numbers instead: 0 is the
+    minimum of the mesh's bounding box and 65535 the maximum, on each axis (the error is at most
+    1/131070 of the box size, far below a pixel unless the mesh is enormous on screen).
+    Indices are 16 bit too when the mesh has at most 65536 vertices. Colors stay as they are.
+    That's 10 bytes per vertex and 2 per index instead of 16 and 4.
+    Unpacking a position is a scale and an offset, which is what a matrix does anyway, so
+    it's folded into the mvp matrix and the vertex loop reads the 16 bit numbers directly.
+*/
+struct PackedMesh {
+    AABB bounds;                // box the positions are quantized to
+    std::vector<Uint16> positions;   // x, y, z per vertex
+    std::vector<Uint32> colors;
+    std::vector<Uint16> indices16;   // used if the mesh has at most 65536 vertices
+    std::vector<Uint32> indices32;   // used otherwise
+};
+
+PackedMesh packMesh(const Mesh& mesh);
+Mat4 dequantizeMatrix(const PackedMesh& packed);
+
+template <class IndexList>
+void fillPackedTriangles(Screen& screen, const IndexList& indices, const FrameVector<Vertex>& projected,
+                         const FrameVector<char>& valid) {
+    for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+        int a = indices[t], b = indices[t + 1], c = indices[t + 2];
+        if (!valid[a] || !valid[b] || !valid[c]) continue;
+        fillTriangle(screen, projected[a], projected[b], projected[c]);
+    }
+}
+
+void drawPackedMesh(Screen& screen, const PackedMesh& packed, const Mat4& mvp);
+
+/*
+    Level of detail (LOD)
+    A mesh far away from the camera might cover a few pixels, but still sends all its triangles
+    through the setup in fillTriangle(). So we make simpler versions of each mesh ahead of time and
+    pick one per draw, depending on how big the mesh is on screen.
+
+    The simpler versions are made with quadric edge collapse (Garland & Heckbert, "Surface Simplification
+    Using Quadric Error Metrics"): every vertex keeps a 4x4 matrix (quadric) that measures the squared
+    distance to the planes of its original triangles. Collapsing an edge (merging its two vertices into
+    one) costs the error of the merged vertex against both quadrics, and we always collapse the cheapest
+    edge first until the mesh has few enough triangles.
+*/
+struct Quadric {
+    // Symmetric 4x4 matrix, only the upper triangle is stored:
+    // a2 ab ac ad / b2 bc bd / c2 cd / d2
+    double q[10];
+};
+
+Quadric planeQuadric(double a, double b, double c, double d);
+void addQuadric(Quadric& to, const Quadric& from);
+double quadricError(const Quadric& quadric, Vec3 p);
+Vec3 faceNormal(Vec3 a, Vec3 b, Vec3 c);
+
+// A possible collapse: vertex "from" is merged into vertex "to" (which stays where it is)
+struct EdgeCollapse {
+    double cost;
+    int from;
+    int to;
+    int fromVersion;    // to notice if either vertex changed since this was computed
+    int toVersion;
+
+    bool operator>(const EdgeCollapse& other) const { return cost > other.cost; }
+};
+
+Mesh simplifyMesh(const Mesh& mesh, int targetTriangles);
+
+/*
+    A mesh and its simplified versions
+    levels[0] is the full mesh, and every level after it has about half the triangles of the one before.
+*/
+struct MeshLOD {
+    std::vector<Mesh> levels;
+};
+
+extern float LOD_PIXELS_PER_TRIANGLE;
+MeshLOD buildMeshLOD(const Mesh& mesh, int numLevels);
+int selectLOD(const Screen& screen, const MeshLOD& lod, const Mat4& mvp);
+void drawMeshLOD(Screen& screen, const MeshLOD& lod, const Mat4& mvp);
+
+/*
+    Frustum culling
+    The camera only sees a truncated pyramid (the view frustum), bounded by 6 planes:
+    left, right, bottom, top, near and far. Each plane is a*x + b*y + c*z + d >= 0 on the inside,
+    and the planes can be read straight out of the rows of the view-projection matrix
+    (Gribb & Hartmann, "Fast Extraction of Viewing Frustum Planes from the World-View-Projection Matrix").
+*/
+struct Frustum {
+    float planes[6][4];
+};
+
+Frustum extractFrustum(const Mat4& viewProj);
+
+// What a frustum test says about a box
+enum CullResult {
+    CULL_OUTSIDE,       // completely outside, skip it
+    CULL_INTERSECTS,    // partly inside
+    CULL_INSIDE         // completely inside, no need to test anything below it
+};
+
+/*
+    Scene bounding volume hierarchy (BVH)
+    A tree of boxes: each node's box contains everything below it, so if a node is outside the
+    frustum, the whole subtree (maybe thousands of objects) is skipped with one test.
+    Each node has up to 4 children whose boxes are stored "structure of arrays" style
+    (all 4 min x values together, all 4 min y values, ...), so one loop tests all 4 boxes against
+    a plane at the same time. The compiler turns that loop into SIMD instructions.
+*/
+struct SceneObject {
+    const Mesh* mesh;
+    Mat4 model;         // model -> world transform
+    AABB worldBounds;   // mesh bounds in world space (see updateObjectBounds())
+    const MeshLOD* lod; // simplified versions of mesh, or NULL to always draw the full mesh
+};
+
+void updateObjectBounds(SceneObject& object);
+
+const int BVH_WIDTH = 4;
+
+struct BVHNode {
+    float minX[BVH_WIDTH], minY[BVH_WIDTH], minZ[BVH_WIDTH];
+    float maxX[BVH_WIDTH], maxY[BVH_WIDTH], maxZ[BVH_WIDTH];
+    int child[BVH_WIDTH];   // >= 0: index of a child node, < 0: object -(child + 1)
+    int count;              // how many of the 4 slots are used
+};
+
+struct SceneBVH {
+    std::vector<BVHNode> nodes;  // nodes[0] is the root
+};
+
+AABB objectsBounds(const std::vector<SceneObject>& objects, const std::vector<int>& ids, int first, int last);
+int buildBVHNode(SceneBVH& bvh, const std::vector<SceneObject>& objects, std::vector<int>& ids, int first, int last);
+SceneBVH buildSceneBVH(const std::vector<SceneObject>& objects);
+void cullNodeChildren(const BVHNode& node, const Frustum& frustum, CullResult results[BVH_WIDTH]);
+void collectAllObjects(const SceneBVH& bvh, int nodeIndex, std::vector<int>& visible);
+std::vector<int> cullScene(const SceneBVH& bvh, const Frustum& frustum);
+void drawScene(Screen& screen, const std::vector<SceneObject>& objects, const SceneBVH& bvh, const Mat4& viewProj);
+
+/*
+    Tiled scene rendering with a binning cache for static objects
+    renderTiled() first projects every object to screen space triangles and sorts ("bins") them into
+    tiles, then draws the tiles in parallel (like renderRetained(), each tile through a scissored copy
+    of the screen). Binning is done on one thread, so it limits how much the threads can help.
+    Most of a scene usually doesn't move (background, terrain, buildings), so the bins of the static
+    objects are kept in a StaticBinCache and only rebuilt when the screen size, the camera or one of
+    the static objects' transforms changes. Dynamic objects are binned again every frame.
+    Triangles are drawn over the whole screen (the viewport is ignored, like the stencil test).
+*/
+struct TileBins {
+    std::vector<Vertex> vertices;        // projected triangles, 3 vertices each
+    std::vector<std::vector<Uint32>> bins;    // per tile: indices of the triangles overlapping it, in drawing order
+};
+
+// Same thing, but only for this frame (allocated from the frame arena)
+struct FrameTileBins {
+    FrameVector<Vertex> vertices;
+    FrameVector<FrameVector<Uint32>> bins;
+};
+
+struct StaticBinCache {
+    bool valid;
+    int width;                      // what the bins were built for
+    int height;
+    int tileSize;
+    Mat4 viewProj;
+    std::vector<const Mesh*> meshes;
+    std::vector<Mat4> models;
+    TileBins bins;
+};
+
+StaticBinCache createStaticBinCache();
+void invalidateStaticBins(StaticBinCache& cache);
+bool sameMatrix(const Mat4& a, const Mat4& b);
+
+// Projects a mesh's triangles (skipping the ones behind the camera) and adds them to the list
+template <class VertexList>
+void projectMeshTriangles(const Screen& screen, const Mesh& mesh, const Mat4& mvp, VertexList& out) {
+    FrameVector<Vertex> projected(mesh.positions.size());
+    FrameVector<char> valid(mesh.positions.size());
+    for (size_t i = 0; i < mesh.positions.size(); i++) {
+        valid[i] = projectVertex(screen, mvp, mesh.positions[i], mesh.colors[i], projected[i]);
+    }
+    for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3) {
+        int a = mesh.indices[t], b = mesh.indices[t + 1], c = mesh.indices[t + 2];
+        if (!valid[a] || !valid[b] || !valid[c]) continue;
+        out.push_back(projected[a]);
+        out.push_back(projected[b]);
+        out.push_back(projected[c]);
+    }
+}
+
+/*
+    Projects objects and bins their triangles into tiles of tileSize x tileSize pixels
+    screen must have the full screen as its viewport. Bins is TileBins or FrameTileBins.
+*/
+template <class Bins>
+void binObjects(const Screen& screen, const std::vector<SceneObject>& objects, const Mat4& viewProj, int tileSize, Bins& out) {
+    int cols = (screen.width + tileSize - 1) / tileSize;
+    int rows = (screen.height + tileSize - 1) / tileSize;
+    out.vertices.clear();
+    out.bins.clear();
+    out.bins.resize((size_t)cols * rows);
+
+    // Step 1: Project every object (using its LOD if it has one)
+    for (const SceneObject& object : objects) {
+        Mat4 mvp = multiply(viewProj, object.model);
+        const Mesh& mesh = object.lod ? object.lod->levels[selectLOD(screen, *object.lod, mvp)] : *object.mesh;
+        projectMeshTriangles(screen, mesh, mvp, out.vertices);
+    }
+
+    // Step 2: Add each triangle to the tiles its bounding box overlaps
+    for (size_t t = 0; t < out.vertices.size() / 3; t++) {
+        const Vertex* v = &out.vertices[t * 3];
+        int maxX = std::max(v[0].x, std::max(v[1].x, v[2].x));
+        int maxY = std::max(v[0].y, std::max(v[1].y, v[2].y));
+        if (maxX < 0 || maxY < 0) continue; // completely off the top or left of the screen
+        int firstCol = std::max(std::min(v[0].x, std::min(v[1].x, v[2].x)) / tileSize, 0);
+        int lastCol = std::min(maxX / tileSize, cols - 1);
+        int firstRow = std::max(std::min(v[0].y, std::min(v[1].y, v[2].y)) / tileSize, 0);
+        int lastRow = std::min(maxY / tileSize, rows - 1);
+        for (int row = firstRow; row <= lastRow; row++) {
+            for (int col = firstCol; col <= lastCol; col++) {
+                out.bins[(size_t)row * cols + col].push_back((Uint32)t);
+            }
+        }
+    }
+}
+
+template <class Bins>
+void drawTileBin(Screen& tileScreen, const Bins& bins, int tile) {
+    for (Uint32 t : bins.bins[tile]) {
+        fillTriangle(tileScreen, bins.vertices[t * 3], bins.vertices[t * 3 + 1], bins.vertices[t * 3 + 2]);
+    }
+}
+
+bool staticBinsValid(const StaticBinCache& cache, const Screen& screen, const std::vector<SceneObject>& objects,
+                     const Mat4& viewProj, int tileSize);
+bool renderTiled(Screen& screen, StaticBinCache& cache, const std::vector<SceneObject>& staticObjects,
+                 const std::vector<SceneObject>& dynamicObjects, const Mat4& viewProj, int tileSize, Uint32 clearColor);
+
+} // namespace rast
+
+#endif // RASTERIZER_H
@@ -0,0 +1,138 @@
+/*
+    C interface to the rasterizer library (see rasterizer_c.h)
+    A rast_context is just an offscreen Screen. Exceptions must not cross into C code,
+    so everything that can throw is caught here and turned into a status code.
+*/
+
+#include <new>
+#include <cstring>
+#include "rasterizer.h"
+#include "rasterizer_c.h"
+using namespace rast;
+
+struct rast_context {
+    Screen screen;
+};
+
+int rast_api_version(void) {
+    return RAST_API_VERSION;
+}
+
+rast_context* rast_create(int width, int height) {
+    // Also rejects sizes where width * height would overflow (see MAX_SCREEN_PIXELS)
+    if (!validScreenSize(width, height)) {
+        return NULL;
+    }
+    rast_context* ctx = NULL;
+    try {
+        ctx = new rast_context;
+        ctx->screen = createOffscreen(width, height);
+    } catch (const std::bad_alloc&) {
+        delete ctx;
+        return NULL;
+    }
+    return ctx;
+}
+
+void rast_destroy(rast_context* ctx) {
+    if (!ctx) {
+        return;
+    }
+    destroyOffscreen(ctx->screen);
+    delete ctx;
+}
+
+void rast_shutdown(void) {
+    stopRowWorkers();
+}
+
+const char* rast_kernels_name(void) {
+    return rasterKernels().name;
+}
+
+rast_status rast_clear(rast_context* ctx, uint32_t color) {
+    if (!ctx) {
+        return RAST_ERROR_INVALID_ARGUMENT;
+    }
+    rasterKernels().fillRow(ctx->screen.pixels, ctx->screen.width * ctx->screen.height, color);
+    return RAST_OK;
+}
+
+rast_status rast_draw_triangles(rast_context* ctx, const rast_vertex* vertices,
+                                int triangle_count, rast_draw_mode mode) {
+    if (!ctx || triangle_count < 0 || (triangle_count > 0 && !vertices)) {
+        return RAST_ERROR_INVALID_ARGUMENT;
+    }
+    if (mode != RAST_DRAW_SOLID && mode != RAST_DRAW_ANTIALIASED && mode != RAST_DRAW_CONSERVATIVE) {
+        return RAST_ERROR_INVALID_ARGUMENT;
+    }
+
+    try {
+        for (int i = 0; i < triangle_count; i++) {
+            // Step 1: Convert the C vertices (same fields, but the layout is only promised on the C side)
+            Vertex v[3];
+            for (int k = 0; k < 3; k++) {
+                const rast_vertex& in = vertices[i * 3 + k];
+                v[k].x = in.x;
+                v[k].y = in.y;
+                v[k].color = in.color;
+                v[k].z = in.z;
+            }
+
+            // Step 2: Draw with the requested mode
+            if (mode == RAST_DRAW_ANTIALIASED) {
+                fillTriangleAA(ctx->screen, v[0], v[1], v[2]);
+            } else if (mode == RAST_DRAW_CONSERVATIVE) {
+                fillTriangleConservative(ctx->screen, v[0], v[1], v[2]);
+            } else {
+                fillTriangle(ctx->screen, v[0], v[1], v[2]);
+            }
+        }
+    } catch (const std::bad_alloc&) {
+        resetFrameArena();
+        return RAST_ERROR_OUT_OF_MEMORY;
+    }
+
+    // Nothing from the frame arena outlives the call, so the scratch memory can be reused right away
+    resetFrameArena();
+    return RAST_OK;
+}
+
+rast_status rast_readback(const rast_context* ctx, uint32_t* out, int stride_bytes) {
+    if (!ctx || !out || stride_bytes < ctx->screen.width * (int)sizeof(uint32_t)) {
+        return RAST_ERROR_INVALID_ARGUMENT;
+    }
+    const Screen& screen = ctx->screen;
+    for (int y = 0; y < screen.height; y++) {
+        char* row = (char*)out + (size_t)y * stride_bytes;
+        memcpy(row, screen.pixels + y * screen.width, screen.width * sizeof(Uint32));
+    }
+    return RAST_OK;
+}
+
+rast_status rast_set_viewport(rast_context* ctx, int x, int y, int width, int height) {
+    if (!ctx || width < 0 || height < 0) {
+        return RAST_ERROR_INVALID_ARGUMENT;
+    }
+    ClipRect viewport = {x, y, width, height};
+    ctx->screen.viewport = viewport;
+    return RAST_OK;
+}
+
+rast_status rast_set_scissor(rast_context* ctx, int enabled, int x, int y, int width, int height) {
+    if (!ctx || width < 0 || height < 0) {
+        return RAST_ERROR_INVALID_ARGUMENT;
+    }
+    ClipRect scissor = {x, y, width, height};
+    ctx->screen.scissorEnabled = enabled != 0;
+    ctx->screen.scissor = scissor;
+    return RAST_OK;
+}
+
+rast_status rast_set_linear_color(rast_context* ctx, int enabled) {
+    if (!ctx) {
+        return RAST_ERROR_INVALID_ARGUMENT;
+    }
+    ctx->screen.linearColor = enabled != 0;
+    return RAST_OK;
+}
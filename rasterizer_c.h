@@ -0,0 +1,105 @@
+/*
+    C interface to the rasterizer library
+    Lets programs that aren't written in C++ (or that just want a stable ABI) draw triangles
+    into an offscreen buffer and read the pixels back, without SDL and without a window.
+
+    Colors are 0xRRGGBBAA like everywhere else in the rasterizer.
+    Every function that can fail returns a rast_status (RAST_OK = 0 on success).
+
+    Typical use:
+        rast_context* ctx = rast_create(640, 480);
+        rast_clear(ctx, 0x000000FF);
+        rast_draw_triangles(ctx, vertices, triangleCount, RAST_DRAW_SOLID);
+        rast_readback(ctx, pixels, 640 * 4);
+        rast_destroy(ctx);
+*/
+
+#ifndef RASTERIZER_C_H
+#define RASTERIZER_C_H
+
+#include <stdint.h>
+
+/*
+    RAST_API marks the functions exported from the shared library
+    - building the dll: define RAST_BUILDING_DLL
+    - linking the static library: define RAST_STATIC so nothing gets dllimport
+*/
+#if defined(RAST_STATIC)
+    #define RAST_API
+#elif defined(_WIN32)
+    #ifdef RAST_BUILDING_DLL
+        #define RAST_API __declspec(dllexport)
+    #else
+        #define RAST_API __declspec(dllimport)
+    #endif
+#else
+    #define RAST_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Bumped whenever a function or struct in this header changes in an incompatible way
+#define RAST_API_VERSION 1
+
+typedef struct rast_context rast_context;   // opaque, owns the pixel buffer and render state
+
+typedef struct rast_vertex {
+    int32_t x;
+    int32_t y;
+    uint32_t color;     // 0xRRGGBBAA
+    float z;            // depth, currently unused by the C interface (set it to 0)
+} rast_vertex;
+
+typedef enum rast_status {
+    RAST_OK = 0,
+    RAST_ERROR_INVALID_ARGUMENT = 1,
+    RAST_ERROR_OUT_OF_MEMORY = 2
+} rast_status;
+
+typedef enum rast_draw_mode {
+    RAST_DRAW_SOLID = 0,        // fillTriangle()
+    RAST_DRAW_ANTIALIASED = 1,  // fillTriangleAA()
+    RAST_DRAW_CONSERVATIVE = 2  // fillTriangleConservative()
+} rast_draw_mode;
+
+// Returns RAST_API_VERSION of the library that was actually loaded
+RAST_API int rast_api_version(void);
+
+// Returns NULL if the size is invalid (not positive, or more than 2^28 pixels) or there isn't enough memory
+RAST_API rast_context* rast_create(int width, int height);
+RAST_API void rast_destroy(rast_context* ctx);
+
+/*
+    Stops the worker threads the library draws with (they start again when needed)
+    Call it before unloading the shared library. They are also stopped when the program exits.
+*/
+RAST_API void rast_shutdown(void);
+
+// Name of the instruction set the library draws with ("sse2", "avx2", "avx512" or "generic")
+RAST_API const char* rast_kernels_name(void);
+
+// Fills the whole buffer with one color (ignores viewport and scissor)
+RAST_API rast_status rast_clear(rast_context* ctx, uint32_t color);
+
+// vertices holds 3 * triangle_count vertices, one triangle after another
+RAST_API rast_status rast_draw_triangles(rast_context* ctx, const rast_vertex* vertices,
+                                         int triangle_count, rast_draw_mode mode);
+
+/*
+    Copies the pixels into out, one row every stride_bytes bytes
+    stride_bytes must be at least width * 4
+*/
+RAST_API rast_status rast_readback(const rast_context* ctx, uint32_t* out, int stride_bytes);
+
+// Render state, same meaning as Screen's viewport/scissor/linearColor
+RAST_API rast_status rast_set_viewport(rast_context* ctx, int x, int y, int width, int height);
+RAST_API rast_status rast_set_scissor(rast_context* ctx, int enabled, int x, int y, int width, int height);
+RAST_API rast_status rast_set_linear_color(rast_context* ctx, int enabled);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1147 @@
+/*
+    Headless tests for the rasterizer library
+    Checks the promises the faster code paths make: that they draw exactly the same pixels as the
+    plain version they replace (or, for culling, never hide something that is visible), and checks
+    the rest against brute force versions (testing every pixel or every triangle).
+    Prints one line per check and returns 1 if any of them failed, so "make test" fails too.
+
+    Usage: ./tests
+*/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "rasterizer.h"
+#include "rasterizer_c.h"
+using namespace std;
+using namespace rast;
+
+/*
+    Hash of the 300 triangle scene in baselineScene(), drawn by the original fillTriangle()
+    (before spans, row pointers, threads and CPU-specific kernels). Every version since has to
+    produce exactly these pixels.
+*/
+const Uint64 BASELINE_HASH = 0x4ba3c43972b038b3ULL;
+
+int failures = 0;
+
+void check(const string& name, bool passed) {
+    cout << (passed ? "PASS " : "FAIL ") << name << endl;
+    if (!passed) failures++;
+}
+
+// Small random number generator so every run tests exactly the same triangles
+Uint32 testSeed = 1;
+
+int testRandom(int low, int high) {
+    testSeed = testSeed * 1103515245 + 12345;
+    return low + (int)((testSeed >> 8) % (Uint32)(high - low + 1));
+}
+
+// FNV-1a over all the pixels
+Uint64 hashPixels(const Uint32* pixels, size_t count) {
+    Uint64 hash = 1469598103934665603ULL;
+    for (size_t i = 0; i < count; i++) {
+        hash ^= pixels[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+Uint64 hashScreen(const Screen& screen) {
+    return hashPixels(screen.pixels, (size_t)screen.width * screen.height);
+}
+
+bool sameScreen(const Screen& a, const Screen& b) {
+    if (a.width != b.width || a.height != b.height) return false;
+    for (int i = 0; i < a.width * a.height; i++) {
+        if (a.pixels[i] != b.pixels[i]) return false;
+    }
+    return true;
+}
+
+void clearScreen(Screen& screen, Uint32 color) {
+    for (int i = 0; i < screen.width * screen.height; i++) screen.pixels[i] = color;
+}
+
+// Triangles with corners anywhere in [low, high], many partly or fully off screen
+vector<vector<Vertex>> randomTriangles(int count, int low, int high) {
+    Uint32 colors[6] = {0xFF0000FF, 0x00FF00FF, 0x0000FFFF, 0xFFA500FF, 0xFFD700FF, 0xFFC0CBFF};
+    vector<vector<Vertex>> triangles;
+    for (int i = 0; i < count; i++) {
+        vector<Vertex> triangle;
+        for (int v = 0; v < 3; v++) {
+            Vertex vertex;
+            vertex.x = testRandom(low, high);
+            vertex.y = testRandom(low, high);
+            vertex.color = colors[(i + v) % 6];
+            vertex.z = 0;
+            triangle.push_back(vertex);
+        }
+        triangles.push_back(triangle);
+    }
+    return triangles;
+}
+
+// The scene BASELINE_HASH was recorded from (500x500, black, 300 triangles)
+Screen baselineScene() {
+    testSeed = 1;
+    Screen screen = createOffscreen(500, 500);
+    for (int i = 0; i < 300; i++) {
+        Vertex v[3];
+        for (int k = 0; k < 3; k++) {
+            testSeed = testSeed * 1103515245 + 12345;
+            v[k].x = (int)((testSeed >> 8) % 700) - 100;
+            testSeed = testSeed * 1103515245 + 12345;
+            v[k].y = (int)((testSeed >> 8) % 700) - 100;
+        }
+        Uint32 colors[6] = {0xFF0000FF, 0x00FF00FF, 0x0000FFFF, 0xFFA500FF, 0xFFD700FF, 0xFFC0CBFF};
+        for (int k = 0; k < 3; k++) {
+            v[k].color = colors[(i + k) % 6];
+            v[k].z = 0;
+        }
+        fillTriangle(screen, v[0], v[1], v[2]);
+    }
+    return screen;
+}
+
+// fillTriangle() still draws the same pixels as the original version
+void testFillBaseline() {
+    Screen screen = baselineScene();
+    check("fillTriangle matches the baseline", hashScreen(screen) == BASELINE_HASH);
+    destroyOffscreen(screen);
+}
+
+// Scissor and stencil only decide which pixels are drawn, never what color they get
+void testScissorStencil() {
+    testSeed = 13;
+    vector<vector<Vertex>> triangles = randomTriangles(200, -50, 350);
+    Screen plain = createOffscreen(300, 300);
+    for (const auto& t : triangles) fillTriangle(plain, t[0], t[1], t[2]);
+
+    // Scissor: the same pixels inside the rectangle, nothing outside
+    Screen scissored = createOffscreen(300, 300);
+    ClipRect rect = {40, 70, 150, 110};
+    scissored.scissorEnabled = true;
+    scissored.scissor = rect;
+    for (const auto& t : triangles) fillTriangle(scissored, t[0], t[1], t[2]);
+    bool same = true;
+    for (int y = 0; y < 300; y++) {
+        for (int x = 0; x < 300; x++) {
+            bool inside = x >= rect.x && x < rect.x + rect.width && y >= rect.y && y < rect.y + rect.height;
+            Uint32 expected = inside ? plain.pixels[y * 300 + x] : 0x000000FF;
+            if (scissored.pixels[y * 300 + x] != expected) same = false;
+        }
+    }
+    check("scissor keeps exactly the pixels inside the rectangle", same);
+
+    // Stencil: draw a mask into the stencil buffer only, then draw the triangles where it is set
+    CoverageMask mask = createCoverageMask(300, 300);
+    Screen stenciled = createOffscreen(300, 300);
+    clearStencil(stenciled, 0);
+    StencilState writeMask = {true, STENCIL_ALWAYS, 1, STENCIL_REPLACE, false};
+    stenciled.stencilState = writeMask;
+    for (const auto& t : randomTriangles(20, -50, 350)) {
+        fillTriangle(stenciled, t[0], t[1], t[2]);
+        rasterizeCoverage(mask, t[0], t[1], t[2]);
+    }
+    bool maskOnly = true;
+    for (int y = 0; y < 300; y++) {
+        for (int x = 0; x < 300; x++) {
+            if (stenciled.pixels[y * 300 + x] != 0x000000FF) maskOnly = false;
+            if (stenciled.stencil[y * 300 + x] != (maskTest(mask, x, y) ? 1 : 0)) maskOnly = false;
+        }
+    }
+    check("stencil-only drawing writes the mask and no colors", maskOnly);
+
+    StencilState testMask = {true, STENCIL_EQUAL, 1, STENCIL_KEEP, true};
+    stenciled.stencilState = testMask;
+    for (const auto& t : triangles) fillTriangle(stenciled, t[0], t[1], t[2]);
+    same = true;
+    for (int y = 0; y < 300; y++) {
+        for (int x = 0; x < 300; x++) {
+            Uint32 expected = maskTest(mask, x, y) ? plain.pixels[y * 300 + x] : 0x000000FF;
+            if (stenciled.pixels[y * 300 + x] != expected) same = false;
+        }
+    }
+    check("stencil test draws exactly inside the mask", same);
+
+    // Antialiased edges are blended inside the mask only
+    Screen blended = createOffscreen(300, 300);
+    memcpy(blended.stencil, stenciled.stencil, 300 * 300);
+    blended.stencilState = testMask;
+    for (const auto& t : randomTriangles(50, -50, 350)) fillTriangleAA(blended, t[0], t[1], t[2]);
+    bool insideOnly = true;
+    for (int y = 0; y < 300; y++) {
+        for (int x = 0; x < 300; x++) {
+            if (!maskTest(mask, x, y) && blended.pixels[y * 300 + x] != 0x000000FF) insideOnly = false;
+        }
+    }
+    check("stencil test also masks antialiased triangles", insideOnly);
+
+    destroyOffscreen(plain);
+    destroyOffscreen(scissored);
+    destroyOffscreen(stenciled);
+    destroyOffscreen(blended);
+}
+
+// Strips and fans (which share edges between triangles) draw the same as separate fillTriangle() calls
+void testStripsAndFans() {
+    testSeed = 21;
+    bool stripSame = true, fanSame = true;
+    Screen shared = createOffscreen(400, 400);
+    Screen separate = createOffscreen(400, 400);
+    for (int trial = 0; trial < 20; trial++) {
+        vector<Vertex> vertices;
+        for (const auto& t : randomTriangles(10, -50, 450)) vertices.insert(vertices.end(), t.begin(), t.end());
+        vertices[5] = vertices[4]; // a repeated vertex, like when strips are joined
+
+        clearScreen(shared, 0x000000FF);
+        clearScreen(separate, 0x000000FF);
+        fillTriangleStrip(shared, vertices);
+        for (size_t i = 0; i + 2 < vertices.size(); i++) fillTriangle(separate, vertices[i], vertices[i + 1], vertices[i + 2]);
+        if (!sameScreen(shared, separate)) stripSame = false;
+
+        clearScreen(shared, 0x000000FF);
+        clearScreen(separate, 0x000000FF);
+        fillTriangleFan(shared, vertices);
+        for (size_t i = 1; i + 1 < vertices.size(); i++) fillTriangle(separate, vertices[0], vertices[i], vertices[i + 1]);
+        if (!sameScreen(shared, separate)) fanSame = false;
+    }
+    check("triangle strip matches separate triangles", stripSame);
+    check("triangle fan matches separate triangles", fanSame);
+    destroyOffscreen(shared);
+    destroyOffscreen(separate);
+}
+
+/*
+    Brute force path coverage of pixel row y: for each sample row, the inside intervals come from
+    sorting every edge crossing by x and applying the fill rule, and each pixel adds its overlap
+    with them (the same sample rows as fillPath(), so the results match closely)
+*/
+vector<float> pathRowCoverage(const vector<vector<PathPoint>>& contours, FillRule rule, bool antiAliasing,
+                              int y, int width) {
+    vector<float> coverage(width, 0.0f);
+    int samples = antiAliasing ? PATH_AA_SAMPLES : 1;
+    for (int s = 0; s < samples; s++) {
+        float sample_y = (samples == 1) ? (float)y : y - 0.5f + (s + 0.5f) / samples;
+        vector<pair<float, int>> crossings;
+        for (const auto& contour : contours) {
+            for (size_t i = 0; i < contour.size(); i++) {
+                PathPoint p = contour[i];
+                PathPoint q = contour[(i + 1) % contour.size()];
+                if (p.y == q.y) continue;
+                int winding = (p.y < q.y) ? 1 : -1;
+                if (p.y > q.y) swap(p, q);
+                if (sample_y < p.y || sample_y >= q.y) continue;
+                crossings.push_back(make_pair(p.x + (sample_y - p.y) * ((q.x - p.x) / (q.y - p.y)), winding));
+            }
+        }
+        sort(crossings.begin(), crossings.end());
+        int winding = 0;
+        for (size_t i = 0; i + 1 < crossings.size(); i++) {
+            winding += (rule == FILL_NON_ZERO) ? crossings[i].second : 1;
+            bool inside = (rule == FILL_NON_ZERO) ? (winding != 0) : (winding % 2 != 0);
+            if (!inside) continue;
+            float left = crossings[i].first, right = crossings[i + 1].first;
+            for (int x = 0; x < width; x++) {
+                if (antiAliasing) {
+                    float overlap = min(right, x + 0.5f) - max(left, x - 0.5f);
+                    if (overlap > 0) coverage[x] += overlap / samples;
+                } else if (x >= left && x < right) {
+                    coverage[x] = 1.0f; // pixel centers inside the span
+                }
+            }
+        }
+    }
+    return coverage;
+}
+
+// fillPath() fills what the fill rule says is inside, with and without anti-aliasing
+void testFillPath() {
+    testSeed = 23;
+    bool exact = true, close = true;
+    Screen screen = createOffscreen(200, 200);
+    for (int trial = 0; trial < 40; trial++) {
+        // Self-intersecting contours on top of each other, corners on a quarter pixel grid
+        vector<vector<PathPoint>> contours(1 + trial % 3);
+        for (auto& contour : contours) {
+            int points = testRandom(3, 9);
+            for (int i = 0; i < points; i++) {
+                PathPoint p = {testRandom(-80, 880) / 4.0f, testRandom(-80, 880) / 4.0f};
+                contour.push_back(p);
+            }
+        }
+        FillRule rule = (trial % 2 == 0) ? FILL_EVEN_ODD : FILL_NON_ZERO;
+        for (int aa = 0; aa < 2; aa++) {
+            clearScreen(screen, 0x000000FF);
+            fillPath(screen, contours, 0xFFFFFFFF, rule, aa != 0);
+            for (int y = 0; y < 200; y++) {
+                vector<float> coverage = pathRowCoverage(contours, rule, aa != 0, y, 200);
+                for (int x = 0; x < 200; x++) {
+                    int drawn = (screen.pixels[y * 200 + x] >> 24) & 0xFF;
+                    if (aa == 0 && drawn != (coverage[x] > 0 ? 255 : 0)) exact = false;
+                    // Blending truncates, so a channel can be one level under coverage * 255
+                    float expected = min(coverage[x], 1.0f) * 255;
+                    if (aa != 0 && fabs(drawn - expected) > 1.5f) close = false;
+                }
+            }
+        }
+    }
+    check("fillPath matches the fill rule at every pixel center", exact);
+    check("antialiased fillPath coverage matches the brute force coverage", close);
+
+    // A pentagram: its middle is a hole with even-odd, and filled with non-zero
+    vector<vector<PathPoint>> star(1);
+    for (int i = 0; i < 5; i++) {
+        float angle = i * 4 * 3.14159265f / 5;
+        PathPoint p = {100 + 90 * sinf(angle), 100 - 90 * cosf(angle)};
+        star[0].push_back(p);
+    }
+    clearScreen(screen, 0x000000FF);
+    fillPath(screen, star, 0xFFFFFFFF, FILL_EVEN_ODD, false);
+    bool evenOdd = screen.pixels[100 * 200 + 100] == 0x000000FF && screen.pixels[30 * 200 + 100] == 0xFFFFFFFF;
+    clearScreen(screen, 0x000000FF);
+    fillPath(screen, star, 0xFFFFFFFF, FILL_NON_ZERO, false);
+    bool nonZero = screen.pixels[100 * 200 + 100] == 0xFFFFFFFF && screen.pixels[30 * 200 + 100] == 0xFFFFFFFF;
+    check("pentagram has a hole with even-odd and none with non-zero", evenOdd && nonZero);
+    destroyOffscreen(screen);
+}
+
+// Twice the signed area, exact for integer corners
+long long doubleArea(const Vertex& a, const Vertex& b, const Vertex& c) {
+    return (long long)(b.x - a.x) * (c.y - a.y) - (long long)(c.x - a.x) * (b.y - a.y);
+}
+
+// Simple polygons that are star-shaped (random angles and radii) or comb-shaped (not monotone in y)
+vector<Vertex> randomPolygon(int trial) {
+    vector<Vertex> polygon;
+    if (trial % 2 == 0) {
+        int points = testRandom(3, 40);
+        for (int i = 0; i < points; i++) {
+            float angle = (i + testRandom(0, 80) / 100.0f) * 2 * 3.14159265f / points;
+            float radius = (float)testRandom(40, 200);
+            Vertex v = {250 + (int)(radius * cosf(angle)), 250 + (int)(radius * sinf(angle)), 0xFF0000FF, 0};
+            polygon.push_back(v);
+        }
+    } else {
+        int teeth = testRandom(1, 8);
+        for (int i = 0; i < teeth; i++) {
+            int x = 20 + i * 50;
+            Vertex top = {x, 20 + testRandom(0, 40), 0x00FF00FF, 0};
+            Vertex inner = {x + 25, 100 + testRandom(0, 150), 0x0000FFFF, 0};
+            polygon.push_back(top);
+            polygon.push_back(inner);
+        }
+        Vertex right = {20 + teeth * 50, 20, 0x00FF00FF, 0};
+        Vertex bottomRight = {20 + teeth * 50, 400, 0xFF0000FF, 0};
+        Vertex bottomLeft = {20, 400, 0xFF0000FF, 0};
+        polygon.push_back(right);
+        polygon.push_back(bottomRight);
+        polygon.push_back(bottomLeft);
+    }
+    if (trial % 4 >= 2) reverse(polygon.begin(), polygon.end()); // both directions
+    return polygon;
+}
+
+// The triangles cover the polygon's area exactly, and the cache hands back the same triangles
+void testTriangulation() {
+    testSeed = 25;
+    bool areas = true, indices = true;
+    for (int trial = 0; trial < 200; trial++) {
+        vector<Vertex> polygon = randomPolygon(trial);
+        vector<int> triangles = triangulatePolygon(polygon);
+        long long polygonArea = 0;
+        for (size_t i = 1; i + 1 < polygon.size(); i++) polygonArea += doubleArea(polygon[0], polygon[i], polygon[i + 1]);
+        long long sum = 0;
+        for (size_t t = 0; t + 2 < triangles.size(); t += 3) {
+            for (int k = 0; k < 3; k++) {
+                if (triangles[t + k] < 0 || triangles[t + k] >= (int)polygon.size()) indices = false;
+            }
+            if (!indices) break;
+            sum += llabs(doubleArea(polygon[triangles[t]], polygon[triangles[t + 1]], polygon[triangles[t + 2]]));
+        }
+        if (triangles.size() % 3 != 0 || triangles.size() > (polygon.size() - 2) * 3) indices = false;
+        if (indices && sum != llabs(polygonArea)) areas = false;
+    }
+    check("triangulation indices are valid", indices);
+    check("triangle areas add up to the polygon area", areas);
+
+    TriangulationCache cache;
+    vector<Vertex> polygon = randomPolygon(1);
+    const vector<int>& first = triangulateCached(cache, polygon);
+    bool sameTriangles = first == triangulatePolygon(polygon);
+    for (Vertex& v : polygon) v.color = 0xFFFFFFFF; // colors don't change the triangles
+    bool hit = &triangulateCached(cache, polygon) == &first && cache.entries.size() == 1;
+    polygon[0].x += 1;
+    bool miss = triangulateCached(cache, polygon) == triangulatePolygon(polygon) && cache.entries.size() == 2;
+    check("triangulation cache hits for the same positions and misses for new ones", sameTriangles && hit && miss);
+
+    Screen cached = createOffscreen(500, 500);
+    Screen direct = createOffscreen(500, 500);
+    fillPolygon(cached, cache, polygon);
+    vector<int> triangles = triangulatePolygon(polygon);
+    for (size_t t = 0; t + 2 < triangles.size(); t += 3) {
+        fillTriangle(direct, polygon[triangles[t]], polygon[triangles[t + 1]], polygon[triangles[t + 2]]);
+    }
+    check("fillPolygon draws its triangulation", sameScreen(cached, direct));
+    destroyOffscreen(cached);
+    destroyOffscreen(direct);
+}
+
+/*
+    fillTriangleConservative() draws every pixel whose square touches the triangle
+    Brute force with exact integer math: a pixel's square and the triangle overlap unless one of the
+    triangle's edges or the bounding box separates them. Pixels the square only touches (an edge
+    passes exactly through a corner) may go either way.
+*/
+void testConservative() {
+    testSeed = 27;
+    Screen screen = createOffscreen(200, 200);
+    bool exact = true, slivers = true;
+    for (int trial = 0; trial < 300; trial++) {
+        Vertex v[3];
+        if (trial % 3 == 0) {
+            // Long thin triangles, which slip between pixel centers
+            int x = testRandom(-20, 150), y = testRandom(-20, 180);
+            Vertex a = {x, y, 0xFF0000FF, 0}, b = {x + testRandom(20, 80), y + 1, 0x00FF00FF, 0}, c = {x + testRandom(90, 120), y + 3, 0x0000FFFF, 0};
+            v[0] = a; v[1] = b; v[2] = c;
+        } else {
+            vector<vector<Vertex>> random = randomTriangles(1, -20, 220);
+            v[0] = random[0][0]; v[1] = random[0][1]; v[2] = random[0][2];
+        }
+        long long area = doubleArea(v[0], v[1], v[2]);
+        if (area == 0) continue;
+
+        clearScreen(screen, 0x000000FF);
+        fillTriangleConservative(screen, v[0], v[1], v[2]);
+
+        int minX = min(v[0].x, min(v[1].x, v[2].x)), maxX = max(v[0].x, max(v[1].x, v[2].x));
+        int minY = min(v[0].y, min(v[1].y, v[2].y)), maxY = max(v[0].y, max(v[1].y, v[2].y));
+        int drawnCount = 0;
+        for (int y = 0; y < 200; y++) {
+            for (int x = 0; x < 200; x++) {
+                bool drawn = screen.pixels[y * 200 + x] != 0x000000FF;
+                drawnCount += drawn;
+
+                // Twice the edge function at the pixel center, plus how far the square reaches out
+                bool separated = x < minX || x > maxX || y < minY || y > maxY;
+                bool touching = false;
+                for (int i = 0; i < 3 && !separated; i++) {
+                    const Vertex& p = v[i];
+                    const Vertex& q = v[(i + 1) % 3];
+                    long long a = -(long long)(q.y - p.y), b = q.x - p.x;
+                    long long edge = 2 * (a * (x - p.x) + b * (y - p.y));
+                    if (area < 0) edge = -edge;
+                    long long reach = llabs(a) + llabs(b);
+                    if (edge + reach < 0) separated = true;
+                    else if (edge + reach == 0) touching = true;
+                }
+                if (!touching && drawn == separated) exact = false;
+            }
+        }
+        if (trial % 3 == 0 && drawnCount == 0 && minX >= 0 && maxX < 200 && minY >= 0 && maxY < 200) slivers = false;
+    }
+    check("conservative rasterization draws exactly the pixels the triangle touches", exact);
+    check("conservative rasterization never loses thin triangles", slivers);
+    destroyOffscreen(screen);
+}
+
+// A pixel is set in the coverage mask exactly when fillTriangle() draws it
+void testMaskCoverage() {
+    testSeed = 5;
+    Screen screen = createOffscreen(500, 500);
+    CoverageMask mask = createCoverageMask(500, 500);
+    vector<vector<Vertex>> triangles = randomTriangles(1000, -100, 600);
+    for (const auto& t : triangles) {
+        fillTriangle(screen, t[0], t[1], t[2]);
+        rasterizeCoverage(mask, t[0], t[1], t[2]);
+    }
+
+    bool same = true;
+    Uint64 drawn = 0;
+    for (int y = 0; y < 500; y++) {
+        for (int x = 0; x < 500; x++) {
+            bool covered = screen.pixels[y * 500 + x] != 0x000000FF;
+            drawn += covered;
+            if (covered != maskTest(mask, x, y)) same = false;
+        }
+    }
+    check("coverage mask matches fillTriangle", same);
+    check("maskArea counts the drawn pixels", maskArea(mask) == drawn);
+
+    ClipRect rect = {37, 41, 300, 200};
+    Uint64 inRect = 0;
+    for (int y = rect.y; y < rect.y + rect.height; y++) {
+        for (int x = rect.x; x < rect.x + rect.width; x++) inRect += maskTest(mask, x, y);
+    }
+    check("maskArea of a rectangle", maskArea(mask, rect) == inRect);
+
+    CoverageMask other = createCoverageMask(500, 500);
+    for (const auto& t : randomTriangles(300, -100, 600)) rasterizeCoverage(other, t[0], t[1], t[2]);
+    Uint64 overlap = 0;
+    for (int y = 0; y < 500; y++) {
+        for (int x = 0; x < 500; x++) overlap += maskTest(mask, x, y) && maskTest(other, x, y);
+    }
+    check("maskOverlapArea counts pixels set in both", maskOverlapArea(mask, other) == overlap);
+    destroyOffscreen(screen);
+}
+
+// Shading a visibility buffer gives the same picture as drawing the triangles in order
+void testVisibilityShading() {
+    testSeed = 11;
+    vector<vector<Vertex>> triangles = randomTriangles(300, -100, 600);
+    Screen direct = createOffscreen(500, 500);
+    Screen shaded = createOffscreen(500, 500);
+    for (const auto& t : triangles) fillTriangle(direct, t[0], t[1], t[2]);
+
+    VisibilityBuffer buffer = createVisibilityBuffer(500, 500);
+    for (size_t i = 0; i < triangles.size(); i++) {
+        rasterizeVisibility(buffer, triangles[i][0], triangles[i][1], triangles[i][2], (Uint32)i);
+    }
+    shadeVisibility(shaded, buffer, triangles);
+    check("visibility shading matches fillTriangle", sameScreen(direct, shaded));
+    destroyOffscreen(direct);
+    destroyOffscreen(shaded);
+}
+
+// Redrawing only the dirty tiles gives the same picture as redrawing everything
+void testRetained() {
+    testSeed = 3;
+    Screen screen = createOffscreen(500, 500);
+    Screen full = createOffscreen(500, 500);
+    RetainedScene scene = createRetainedScene(500, 500, 64, 0x000000FF);
+    vector<vector<Vertex>> triangles = randomTriangles(400, -50, 550);
+    for (const auto& t : triangles) retainedAdd(scene, t[0], t[1], t[2]);
+
+    bool same = true;
+    for (int frame = 0; frame < 30; frame++) {
+        renderRetained(screen, scene);
+        clearScreen(full, 0x000000FF);
+        for (size_t i = 0; i < triangles.size(); i++) {
+            if (scene.triangles[i].alive) fillTriangle(full, triangles[i][0], triangles[i][1], triangles[i][2]);
+        }
+        if (!sameScreen(screen, full)) same = false;
+
+        // Move a few triangles, and remove one now and then
+        for (int k = 0; k < 3; k++) {
+            int id = testRandom(0, (int)triangles.size() - 1);
+            int dx = testRandom(-10, 10);
+            int dy = testRandom(-10, 10);
+            for (Vertex& v : triangles[id]) {
+                v.x += dx;
+                v.y += dy;
+            }
+            if (scene.triangles[id].alive) retainedUpdate(scene, id, triangles[id][0], triangles[id][1], triangles[id][2]);
+        }
+        if (frame % 10 == 5) retainedRemove(scene, testRandom(0, (int)triangles.size() - 1));
+        resetFrameArena();
+    }
+    check("retained rendering matches a full redraw", same);
+    destroyOffscreen(screen);
+    destroyOffscreen(full);
+}
+
+// Picking through the grid gives the same answers as testing every triangle, also after moves and removals
+void testPicking() {
+    testSeed = 31;
+    PickIndex index = createPickIndex(400, 300, 32);
+    vector<vector<Vertex>> triangles = randomTriangles(300, -50, 450);
+    for (const auto& t : triangles) pickAdd(index, t[0], t[1], t[2]);
+
+    bool points = true, rects = true;
+    for (int round = 0; round < 4; round++) {
+        for (int q = 0; q < 500; q++) {
+            int x = testRandom(0, 399), y = testRandom(0, 299);
+            Uint32 expected = PICK_NONE;
+            for (size_t id = 0; id < index.triangles.size(); id++) {
+                const PickTriangle& t = index.triangles[id];
+                if (t.alive && pointInTriangle(t.v[0], t.v[1], t.v[2], x, y)) expected = (Uint32)id;
+            }
+            if (pickPoint(index, x, y) != expected) points = false;
+        }
+        for (int q = 0; q < 50; q++) {
+            ClipRect rect = {testRandom(0, 399), testRandom(0, 299), 0, 0};
+            rect.width = testRandom(1, 400 - rect.x);
+            rect.height = testRandom(1, 300 - rect.y);
+            vector<Uint32> expected;
+            for (size_t id = 0; id < index.triangles.size(); id++) {
+                if (index.triangles[id].alive && triangleOverlapsRect(index.triangles[id], rect)) expected.push_back((Uint32)id);
+            }
+            if (pickRect(index, rect) != expected) rects = false;
+        }
+
+        // Move some triangles and remove a few
+        for (int k = 0; k < 40; k++) {
+            int id = testRandom(0, (int)triangles.size() - 1);
+            int dx = testRandom(-60, 60), dy = testRandom(-60, 60);
+            for (Vertex& v : triangles[id]) {
+                v.x += dx;
+                v.y += dy;
+            }
+            pickUpdate(index, id, triangles[id][0], triangles[id][1], triangles[id][2]);
+        }
+        for (int k = 0; k < 5; k++) pickRemove(index, testRandom(0, (int)triangles.size() - 1));
+    }
+    check("pickPoint matches testing every triangle", points);
+    check("pickRect matches testing every triangle", rects);
+
+    PickIndex tiny = createPickIndex(10, 10, 0);
+    pickAdd(tiny, triangles[0][0], triangles[0][1], triangles[0][2]);
+    check("a pick cell size of 0 is clamped to 1", tiny.cellSize == 1 && tiny.cols == 10 && tiny.rows == 10);
+}
+
+// The occlusion buffer never says something is hidden when part of it is in front
+void testOcclusionNoFalseCulls() {
+    testSeed = 17;
+    int wrong = 0;
+    for (int scene = 0; scene < 30; scene++) {
+        OcclusionBuffer occlusion = createOcclusionBuffer(256, 128, 1000, 500);
+        VisibilityBuffer visibility = createVisibilityBuffer(1000, 500);
+        for (int i = 0; i < 6; i++) {
+            float z = testRandom(0, 99) / 100.0f;
+            Vertex a = {testRandom(-100, 1100), testRandom(-100, 600), 0xFF0000FF, z};
+            Vertex b = {testRandom(-100, 1100), testRandom(-100, 600), 0xFF0000FF, z};
+            Vertex c = {testRandom(-100, 1100), testRandom(-100, 600), 0xFF0000FF, z};
+            rasterizeOccluder(occlusion, a, b, c);
+            rasterizeVisibility(visibility, a, b, c, i);
+        }
+        for (int o = 0; o < 200; o++) {
+            ScreenBounds bounds;
+            bounds.minX = testRandom(0, 999);
+            bounds.minY = testRandom(0, 499);
+            bounds.maxX = min(999, bounds.minX + testRandom(0, 59));
+            bounds.maxY = min(499, bounds.minY + testRandom(0, 59));
+            bounds.minZ = testRandom(0, 99) / 100.0f + 0.005f;
+            if (!isOccluded(occlusion, bounds)) continue;
+
+            // Culled: every pixel of the box must have an occluder in front of minZ
+            for (int y = bounds.minY; y <= bounds.maxY; y++) {
+                for (int x = bounds.minX; x <= bounds.maxX; x++) {
+                    if (visibility.depth[y * 1000 + x] >= bounds.minZ) {
+                        wrong++;
+                        x = bounds.maxX;
+                        y = bounds.maxY;
+                    }
+                }
+            }
+        }
+    }
+    check("occlusion culling has no false culls", wrong == 0);
+}
+
+// The BVH returns exactly the objects whose boxes aren't outside a frustum plane
+void testFrustumCulling() {
+    Mesh cube;
+    Vec3 corners[8] = {{-1, -1, -1}, {1, -1, -1}, {1, 1, -1}, {-1, 1, -1}, {-1, -1, 1}, {1, -1, 1}, {1, 1, 1}, {-1, 1, 1}};
+    cube.positions.assign(corners, corners + 8);
+    cube.colors.assign(8, 0xFF0000FF);
+    int indices[12] = {0, 1, 2, 0, 2, 3, 4, 5, 6, 4, 6, 7};
+    cube.indices.assign(indices, indices + 12);
+    computeMeshBounds(cube);
+
+    testSeed = 5;
+    bool same = true;
+    for (int trial = 0; trial < 20; trial++) {
+        vector<SceneObject> objects(1000);
+        for (SceneObject& object : objects) {
+            object.mesh = &cube;
+            object.lod = NULL;
+            object.model = multiply(translationMatrix((float)testRandom(-100, 100), (float)testRandom(-100, 100), (float)testRandom(-100, 100)),
+                                    rotationYMatrix(testRandom(0, 628) / 100.0f));
+            updateObjectBounds(object);
+        }
+        SceneBVH bvh = buildSceneBVH(objects);
+        Vec3 eye = {(float)testRandom(-25, 25), (float)testRandom(-25, 25), (float)testRandom(-25, 25)};
+        Vec3 target = {(float)testRandom(-100, 100), (float)testRandom(-100, 100), (float)testRandom(-100, 100)};
+        Vec3 up = {0, 1, 0};
+        Frustum frustum = extractFrustum(multiply(perspectiveMatrix(1.0f, 1.3f, 0.1f, 80.0f), lookAtMatrix(eye, target, up)));
+        vector<int> visible = cullScene(bvh, frustum);
+        set<int> visibleSet(visible.begin(), visible.end());
+        if (visibleSet.size() != visible.size()) same = false; // nothing listed twice
+
+        // Brute force: a box is outside if its corner furthest along a plane's normal is behind it
+        for (size_t i = 0; i < objects.size(); i++) {
+            const AABB& box = objects[i].worldBounds;
+            bool outside = false;
+            for (int p = 0; p < 6; p++) {
+                const float* plane = frustum.planes[p];
+                float distance = plane[0] * (plane[0] >= 0 ? box.max.x : box.min.x)
+                               + plane[1] * (plane[1] >= 0 ? box.max.y : box.min.y)
+                               + plane[2] * (plane[2] >= 0 ? box.max.z : box.min.z) + plane[3];
+                if (distance < 0) outside = true;
+            }
+            if (outside == (visibleSet.count((int)i) > 0)) same = false;
+        }
+    }
+    check("BVH culling matches testing every object", same);
+}
+
+// A cube from (-1, -1, -1) to (1, 1, 1) with a different color on every corner (bounds not computed)
+Mesh cubeMesh() {
+    Mesh mesh;
+    Vec3 corners[8] = {{-1, -1, -1}, {1, -1, -1}, {1, 1, -1}, {-1, 1, -1}, {-1, -1, 1}, {1, -1, 1}, {1, 1, 1}, {-1, 1, 1}};
+    mesh.positions.assign(corners, corners + 8);
+    Uint32 colors[8] = {0xFF0000FF, 0x00FF00FF, 0x0000FFFF, 0xFFFF00FF, 0xFF00FFFF, 0x00FFFFFF, 0xFFFFFFFF, 0x808080FF};
+    mesh.colors.assign(colors, colors + 8);
+    int indices[36] = {0, 1, 2, 0, 2, 3, 4, 6, 5, 4, 7, 6, 0, 4, 5, 0, 5, 1, 3, 2, 6, 3, 6, 7, 0, 3, 7, 0, 7, 4, 1, 5, 6, 1, 6, 2};
+    mesh.indices.assign(indices, indices + 36);
+    return mesh;
+}
+
+// drawInstanced() (which skips instances outside the view) draws the same as drawMesh() per instance
+void testInstancing() {
+    Mesh mesh = cubeMesh();
+
+    Vec3 eye = {0, 2, 5};
+    Vec3 target = {0, 0, -20};
+    Vec3 up = {0, 1, 0};
+    Mat4 viewProj = multiply(perspectiveMatrix(1.0f, 1.5f, 0.1f, 60.0f), lookAtMatrix(eye, target, up));
+
+    testSeed = 9;
+    InstanceStream instances;
+    clearInstances(instances);
+    Screen instanced = createOffscreen(480, 320);
+    Screen separate = createOffscreen(480, 320);
+    for (int i = 0; i < 500; i++) {
+        // Many of them are off to the sides, behind the camera or past the far plane
+        Mat4 transform = multiply(translationMatrix((float)testRandom(-60, 60), (float)testRandom(-10, 10), (float)testRandom(-80, 10)),
+                                  rotationYMatrix(testRandom(0, 628) / 100.0f));
+        Uint32 tint = (i % 3 == 0) ? 0xFFFFFFFF : 0xFF8040FF;
+        addInstance(instances, transform, tint);
+
+        Mat4 mvp = multiply(viewProj, transform);
+        if (boxOutsideClip(mvp, pointsBounds(mesh.positions))) continue; // drawInstanced() skips these on purpose
+        Mesh tinted = mesh;
+        for (Uint32& color : tinted.colors) color = tintColor(color, tint);
+        drawMesh(separate, tinted, mvp);
+    }
+    drawInstanced(instanced, mesh, viewProj, instances);
+    check("drawInstanced matches drawMesh per instance", sameScreen(instanced, separate));
+    destroyOffscreen(instanced);
+    destroyOffscreen(separate);
+}
+
+// A sphere made of rows x columns quads, with bounds computed
+Mesh sphereMesh(int rows, int columns) {
+    Mesh mesh;
+    for (int r = 0; r <= rows; r++) {
+        float phi = 3.14159265f * r / rows;
+        for (int c = 0; c < columns; c++) {
+            float theta = 2 * 3.14159265f * c / columns;
+            Vec3 p = {sinf(phi) * cosf(theta), cosf(phi), sinf(phi) * sinf(theta)};
+            mesh.positions.push_back(p);
+            mesh.colors.push_back((r + c) % 2 ? 0xFF8000FF : 0x0080FFFF);
+        }
+    }
+    for (int r = 0; r < rows; r++) {
+        for (int c = 0; c < columns; c++) {
+            int a = r * columns + c, b = r * columns + (c + 1) % columns;
+            int quad[6] = {a, a + columns, b, b, a + columns, b + columns};
+            // The top and bottom rows meet in a point, so one of their two triangles would be empty
+            int first = (r == 0) ? 3 : 0;
+            int last = (r == rows - 1) ? 3 : 6;
+            mesh.indices.insert(mesh.indices.end(), quad + first, quad + last);
+        }
+    }
+    computeMeshBounds(mesh);
+    return mesh;
+}
+
+// Every LOD level is a valid, simpler mesh, and further away never picks a more detailed level
+void testLOD() {
+    Mesh sphere = sphereMesh(24, 32);
+    MeshLOD lod = buildMeshLOD(sphere, 5);
+
+    bool simpler = lod.levels.size() > 1;
+    bool valid = true;
+    for (size_t level = 1; level < lod.levels.size(); level++) {
+        const Mesh& mesh = lod.levels[level];
+        if (mesh.indices.size() >= lod.levels[level - 1].indices.size()) simpler = false;
+        if (mesh.colors.size() != mesh.positions.size() || mesh.indices.size() % 3 != 0) valid = false;
+        for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3) {
+            int a = mesh.indices[t], b = mesh.indices[t + 1], c = mesh.indices[t + 2];
+            int count = (int)mesh.positions.size();
+            if (a < 0 || b < 0 || c < 0 || a >= count || b >= count || c >= count) valid = false;
+            else if (a == b || b == c || a == c) valid = false;
+        }
+        // Collapses keep one of the two vertices where it is, so every vertex is an original one
+        for (const Vec3& p : mesh.positions) {
+            bool original = false;
+            for (const Vec3& q : sphere.positions) original = original || (p.x == q.x && p.y == q.y && p.z == q.z);
+            if (!original) valid = false;
+        }
+    }
+    check("every LOD level has fewer triangles than the one before", simpler);
+    check("LOD levels are valid meshes made of the original vertices", valid);
+
+    Screen screen = createOffscreen(640, 480);
+    Vec3 eye = {0, 0, 0};
+    Vec3 target = {0, 0, -1};
+    Vec3 up = {0, 1, 0};
+    Mat4 viewProj = multiply(perspectiveMatrix(1.0f, 640.0f / 480, 0.1f, 1000.0f), lookAtMatrix(eye, target, up));
+    bool monotonic = true;
+    int previous = -1;
+    int nearest = -1;
+    for (float distance = 0.5f; distance < 500; distance *= 1.25f) {
+        int level = selectLOD(screen, lod, multiply(viewProj, translationMatrix(0, 0, -distance)));
+        if (level < previous) monotonic = false;
+        if (nearest < 0) nearest = level;
+        previous = level;
+    }
+    check("LOD selection is full detail up close and gets simpler with distance",
+          monotonic && nearest == 0 && previous == (int)lod.levels.size() - 1);
+    destroyOffscreen(screen);
+}
+
+// renderTiled() draws the same as drawing every object in order, and reuses the static bins when it can
+void testRenderTiled() {
+    Mesh cube = cubeMesh();
+    computeMeshBounds(cube);
+    testSeed = 35;
+    vector<SceneObject> staticObjects(60), dynamicObjects(20);
+    for (SceneObject& object : staticObjects) {
+        object.mesh = &cube;
+        object.lod = NULL;
+        object.model = multiply(translationMatrix((float)testRandom(-30, 30), (float)testRandom(-5, 5), (float)testRandom(-60, 0)),
+                                rotationYMatrix(testRandom(0, 628) / 100.0f));
+    }
+    for (SceneObject& object : dynamicObjects) object = staticObjects[testRandom(0, 59)];
+
+    Vec3 eye = {0, 3, 8};
+    Vec3 target = {0, 0, -20};
+    Vec3 up = {0, 1, 0};
+    Mat4 viewProj = multiply(perspectiveMatrix(1.0f, 320.0f / 240, 0.1f, 100.0f), lookAtMatrix(eye, target, up));
+
+    Screen tiled = createOffscreen(320, 240);
+    Screen direct = createOffscreen(320, 240);
+    StaticBinCache cache = createStaticBinCache();
+    bool same = true;
+    bool cacheHits[6];
+    int tileSizes[6] = {64, 64, 64, 64, 32, 0};
+    for (int frame = 0; frame < 6; frame++) {
+        // Dynamic objects move every frame, frame 3 moves a static one, and the tile size changes at the end
+        for (SceneObject& object : dynamicObjects) object.model = multiply(translationMatrix(0.5f, 0, 0), object.model);
+        if (frame == 3) staticObjects[7].model = multiply(translationMatrix(0, 1, 0), staticObjects[7].model);
+
+        cacheHits[frame] = renderTiled(tiled, cache, staticObjects, dynamicObjects, viewProj, tileSizes[frame], 0x202020FF);
+        clearScreen(direct, 0x202020FF);
+        for (const SceneObject& object : staticObjects) drawMesh(direct, *object.mesh, multiply(viewProj, object.model));
+        for (const SceneObject& object : dynamicObjects) drawMesh(direct, *object.mesh, multiply(viewProj, object.model));
+        if (!sameScreen(tiled, direct)) same = false;
+        resetFrameArena();
+    }
+    check("renderTiled matches drawing every object", same);
+    check("static bins are reused until a static object or the tiles change",
+          !cacheHits[0] && cacheHits[1] && cacheHits[2] && !cacheHits[3] && !cacheHits[4] && !cacheHits[5]);
+    destroyOffscreen(tiled);
+    destroyOffscreen(direct);
+}
+
+// A packed mesh draws the same pixels as the mesh it was packed from
+void testPackedMesh() {
+    Mesh mesh = cubeMesh(); // packMesh() must not need computeMeshBounds()
+    for (Vec3& p : mesh.positions) {
+        p.x = p.x * 3 + 1;
+        p.z = p.z * 2 - 0.5f;
+    }
+    PackedMesh packed = packMesh(mesh);
+
+    bool same = true;
+    Screen plain = createOffscreen(320, 240);
+    Screen fromPacked = createOffscreen(320, 240);
+    for (int view = 0; view < 8; view++) {
+        clearScreen(plain, 0x000000FF);
+        clearScreen(fromPacked, 0x000000FF);
+        float angle = view * 0.8f;
+        Vec3 eye = {sinf(angle) * 9, 3, cosf(angle) * 9};
+        Vec3 target = {1, 0, -0.5f};
+        Vec3 up = {0, 1, 0};
+        Mat4 mvp = multiply(perspectiveMatrix(1.0f, 320.0f / 240, 0.1f, 100.0f), lookAtMatrix(eye, target, up));
+        drawMesh(plain, mesh, mvp);
+        drawPackedMesh(fromPacked, packed, mvp);
+        if (!sameScreen(plain, fromPacked)) same = false;
+    }
+    check("packed mesh matches the unpacked mesh", same);
+    destroyOffscreen(plain);
+    destroyOffscreen(fromPacked);
+}
+
+// Half floats round-trip exactly, and the HDR framebuffers draw the same triangles as RGBA8888
+void testHDRFormats() {
+    bool roundTrip = true;
+    for (Uint32 half = 0; half < 0x10000; half++) {
+        bool nan = (half & 0x7C00) == 0x7C00 && (half & 0x3FF) != 0;
+        if (!nan && floatToHalf(halfToFloat((Uint16)half)) != half) roundTrip = false;
+    }
+    bool known = floatToHalf(1.0f) == 0x3C00 && floatToHalf(-2.0f) == 0xC000 && floatToHalf(65504.0f) == 0x7BFF
+              && floatToHalf(1e6f) == 0x7C00 && floatToHalf(1e-9f) == 0 && halfToFloat(0x0001) == ldexpf(1, -24);
+    check("half floats convert exactly", roundTrip && known);
+
+    bool channels = true;
+    for (Uint32 c = 0; c < 256; c++) {
+        Uint32 color = (c << 24) | ((255 - c) << 16) | (c << 8) | (c ^ 0x5A);
+        if (FormatRGBA16F::decode(FormatRGBA16F::encode(color)) != color) channels = false;
+        if (FormatRGBA32F::decode(FormatRGBA32F::encode(color)) != color) channels = false;
+    }
+    check("HDR formats keep every 8 bit color", channels);
+
+    testSeed = 37;
+    Framebuffer<FormatRGBA8888> rgba8 = createFramebuffer<FormatRGBA8888>(300, 200);
+    Framebuffer<FormatRGBA16F> rgba16f = createFramebuffer<FormatRGBA16F>(300, 200);
+    Framebuffer<FormatRGBA32F> rgba32f = createFramebuffer<FormatRGBA32F>(300, 200);
+    for (const auto& t : randomTriangles(100, -50, 350)) {
+        fillTriangle(rgba8, t[0], t[1], t[2]);
+        fillTriangle(rgba16f, t[0], t[1], t[2]);
+        fillTriangle(rgba32f, t[0], t[1], t[2]);
+    }
+    Screen from16f = createOffscreen(300, 200);
+    Screen from32f = createOffscreen(300, 200);
+    copyToScreen(rgba16f, from16f);
+    copyToScreen(rgba32f, from32f);
+
+    // The float formats interpolate without rounding to 8 bits in between, so allow one level
+    bool close = true;
+    for (int i = 0; i < 300 * 200; i++) {
+        for (int shift = 0; shift < 32; shift += 8) {
+            int expected = (rgba8.pixels[i] >> shift) & 0xFF;
+            if (abs((int)((from16f.pixels[i] >> shift) & 0xFF) - expected) > 1) close = false;
+            if (abs((int)((from32f.pixels[i] >> shift) & 0xFF) - expected) > 1) close = false;
+        }
+    }
+    check("HDR framebuffers draw the same triangles as RGBA8888", close);
+
+    Framebuffer<FormatRGBA16F> converted = createFramebuffer<FormatRGBA16F>(300, 200);
+    convertFramebuffer(rgba32f, converted);
+    bool same = true;
+    for (size_t i = 0; i < converted.pixels.size(); i++) {
+        if (converted.pixels[i].r != floatToHalf(rgba32f.pixels[i].r) || converted.pixels[i].a != floatToHalf(rgba32f.pixels[i].a)) same = false;
+    }
+    check("RGBA32F to RGBA16F conversion rounds each channel to a half", same);
+    destroyOffscreen(from16f);
+    destroyOffscreen(from32f);
+}
+
+// Linear light mixing keeps the ends exact and brightens the middle of a gradient
+void testLinearColor() {
+    const SrgbTables& tables = srgbTables();
+    bool tablesMatch = true;
+    for (int i = 0; i < 256; i++) {
+        if (tables.toSrgb[tables.toLinear[i]] != i) tablesMatch = false;
+    }
+    check("sRGB -> linear -> sRGB gives back every level", tablesMatch);
+
+    testSeed = 39;
+    bool ends = true;
+    for (int i = 0; i < 200; i++) {
+        Uint32 a = ((Uint32)testRandom(0, 0xFFFF) << 16) | (Uint32)testRandom(0, 0xFFFF);
+        Uint32 b = ((Uint32)testRandom(0, 0xFFFF) << 16) | (Uint32)testRandom(0, 0xFFFF);
+        if (interpolateColorLinear(a, b, 0.0f) != a || interpolateColorLinear(a, b, 1.0f) != b) ends = false;
+    }
+    // Half of white's light is sRGB 188, and alpha isn't gamma encoded
+    Uint32 middle = interpolateColorLinear(0x00000000, 0xFFFFFFFF, 0.5f);
+    bool brighter = ((middle >> 24) & 0xFF) == 188 && (middle & 0xFF) == 127;
+    check("linear interpolation keeps the ends and brightens the middle", ends && brighter);
+
+    // Single color triangles don't change, gradients only get brighter in between
+    testSeed = 41;
+    vector<vector<Vertex>> triangles = randomTriangles(100, -50, 350);
+    Screen plain = createOffscreen(300, 300);
+    Screen linear = createOffscreen(300, 300);
+    linear.linearColor = true;
+    for (const auto& t : triangles) {
+        Vertex v[3] = {t[0], t[1], t[2]};
+        for (Vertex& vertex : v) vertex.color = t[0].color;
+        fillTriangle(plain, v[0], v[1], v[2]);
+        fillTriangle(linear, v[0], v[1], v[2]);
+    }
+    bool flatSame = sameScreen(plain, linear);
+
+    Screen gradient = createOffscreen(256, 1);
+    Screen gradientLinear = createOffscreen(256, 1);
+    gradientLinear.linearColor = true;
+    fillSpan(gradient, 0, 0, 255, 0, 255, 0x000000FF, 0xFFFFFFFF);
+    fillSpan(gradientLinear, 0, 0, 255, 0, 255, 0x000000FF, 0xFFFFFFFF);
+    bool brighterSpan = true;
+    for (int x = 1; x < 255; x++) {
+        if ((gradientLinear.pixels[x] >> 24) < (gradient.pixels[x] >> 24)) brighterSpan = false;
+    }
+    check("linear color only changes how colors are mixed", flatSame && brighterSpan);
+    destroyOffscreen(plain);
+    destroyOffscreen(linear);
+    destroyOffscreen(gradient);
+    destroyOffscreen(gradientLinear);
+}
+
+// Dithering never pushes white past the top level or black below zero
+void testDitherExtremes() {
+    Screen screen = createOffscreen(64, 64);
+    for (int i = 0; i < 64 * 64; i++) screen.pixels[i] = (i / 64 < 32) ? 0xFFFFFFFF : 0x000000FF;
+
+    bool exact = true;
+    Framebuffer<FormatRGB565> rgb565 = createFramebuffer<FormatRGB565>(64, 64);
+    Framebuffer<FormatIndexed8> indexed = createFramebuffer<FormatIndexed8>(64, 64);
+    for (int dither = DITHER_NONE; dither <= DITHER_BLUE_NOISE; dither++) {
+        convertScreenDithered(screen, rgb565, (DitherMode)dither);
+        convertScreenDithered(screen, indexed, (DitherMode)dither);
+        for (int i = 0; i < 64 * 64; i++) {
+            bool white = i / 64 < 32;
+            if (rgb565.pixels[i] != (white ? 0xFFFF : 0x0000)) exact = false;
+            if (indexed.pixels[i] != (white ? 0xFF : 0x00)) exact = false;
+        }
+    }
+    check("dithering keeps white and black exact", exact);
+    destroyOffscreen(screen);
+}
+
+// Everything the kernels are used for, hashed together
+Uint64 kernelScene() {
+    testSeed = 7;
+    Screen screen = createOffscreen(640, 480);
+    Uint64 hash = 0;
+    for (int mode = 0; mode < 4; mode++) {
+        screen.linearColor = (mode & 1) != 0;
+        for (const auto& t : randomTriangles(300, -50, 700)) {
+            if (mode < 2) fillTriangle(screen, t[0], t[1], t[2]);
+            else fillTriangleAA(screen, t[0], t[1], t[2]);
+        }
+        hash = hash * 31 + hashScreen(screen);
+    }
+
+    Framebuffer<FormatRGB565> rgb565 = createFramebuffer<FormatRGB565>(640, 480);
+    for (int dither = DITHER_NONE; dither <= DITHER_BLUE_NOISE; dither++) {
+        convertScreenDithered(screen, rgb565, (DitherMode)dither);
+        for (Uint16 pixel : rgb565.pixels) hash = hash * 31 + pixel;
+    }
+
+    CoverageMask mask = createCoverageMask(640, 480);
+    for (const auto& t : randomTriangles(100, -50, 700)) rasterizeCoverage(mask, t[0], t[1], t[2]);
+    hash = hash * 31 + maskArea(mask);
+
+    destroyOffscreen(screen);
+    resetFrameArena();
+    return hash;
+}
+
+// Every kernel set this CPU can run draws the same pixels
+void testKernelSets() {
+    const RasterKernels& original = rasterKernels();
+    vector<const RasterKernels*> sets = supportedRasterKernels();
+    setRasterKernels(*sets[0]);
+    Uint64 expected = kernelScene();
+    bool same = true;
+    for (size_t i = 1; i < sets.size(); i++) {
+        setRasterKernels(*sets[i]);
+        if (kernelScene() != expected) {
+            cout << "     " << sets[i]->name << " differs from " << sets[0]->name << endl;
+            same = false;
+        }
+    }
+    setRasterKernels(original);
+
+    string names;
+    for (const RasterKernels* kernels : sets) names += string(" ") + kernels->name;
+    check("all kernel sets give the same pixels (" + names.substr(1) + ")", same);
+}
+
+// The C interface draws the same pixels as the C++ functions it wraps, and rejects bad arguments
+void testCInterface() {
+    bool rejects = rast_create(0, 10) == NULL && rast_create(10, -1) == NULL && rast_create(1 << 16, 1 << 16) == NULL;
+    rast_context* ctx = rast_create(320, 240);
+    vector<uint32_t> pixels(320 * 240);
+    rast_vertex vertex = {0, 0, 0xFFFFFFFF, 0};
+    rejects = rejects && ctx != NULL
+           && rast_clear(NULL, 0) == RAST_ERROR_INVALID_ARGUMENT
+           && rast_draw_triangles(ctx, NULL, 1, RAST_DRAW_SOLID) == RAST_ERROR_INVALID_ARGUMENT
+           && rast_draw_triangles(ctx, &vertex, -1, RAST_DRAW_SOLID) == RAST_ERROR_INVALID_ARGUMENT
+           && rast_draw_triangles(ctx, &vertex, 0, (rast_draw_mode)7) == RAST_ERROR_INVALID_ARGUMENT
+           && rast_readback(ctx, pixels.data(), 319 * 4) == RAST_ERROR_INVALID_ARGUMENT
+           && rast_set_viewport(ctx, 0, 0, -1, 10) == RAST_ERROR_INVALID_ARGUMENT;
+    check("C interface rejects invalid arguments", rejects);
+    check("C interface reports its version and kernel set",
+          rast_api_version() == RAST_API_VERSION && string(rast_kernels_name()) == rasterKernels().name);
+
+    testSeed = 43;
+    vector<vector<Vertex>> triangles = randomTriangles(100, -50, 370);
+    vector<rast_vertex> vertices;
+    for (const auto& t : triangles) {
+        for (const Vertex& v : t) {
+            rast_vertex out = {v.x, v.y, v.color, v.z};
+            vertices.push_back(out);
+        }
+    }
+    Screen screen = createOffscreen(320, 240);
+    ClipRect viewport = {20, 10, 250, 200};
+    ClipRect scissor = {50, 30, 200, 120};
+    bool same = true;
+    for (int mode = RAST_DRAW_SOLID; mode <= RAST_DRAW_CONSERVATIVE; mode++) {
+        // Every mode, with the viewport, scissor and linear color set through both interfaces
+        rast_clear(ctx, 0x102030FF);
+        rast_set_viewport(ctx, viewport.x, viewport.y, viewport.width, viewport.height);
+        rast_set_scissor(ctx, 1, scissor.x, scissor.y, scissor.width, scissor.height);
+        rast_set_linear_color(ctx, mode == RAST_DRAW_ANTIALIASED);
+        if (rast_draw_triangles(ctx, vertices.data(), (int)triangles.size(), (rast_draw_mode)mode) != RAST_OK) same = false;
+
+        clearScreen(screen, 0x102030FF);
+        screen.viewport = viewport;
+        screen.scissorEnabled = true;
+        screen.scissor = scissor;
+        screen.linearColor = mode == RAST_DRAW_ANTIALIASED;
+        for (const auto& t : triangles) {
+            if (mode == RAST_DRAW_ANTIALIASED) fillTriangleAA(screen, t[0], t[1], t[2]);
+            else if (mode == RAST_DRAW_CONSERVATIVE) fillTriangleConservative(screen, t[0], t[1], t[2]);
+            else fillTriangle(screen, t[0], t[1], t[2]);
+        }
+
+        // Read back with padding at the end of every row
+        vector<uint32_t> padded(330 * 240, 0xDEADBEEF);
+        if (rast_readback(ctx, padded.data(), 330 * 4) != RAST_OK) same = false;
+        for (int y = 0; y < 240; y++) {
+            for (int x = 0; x < 330; x++) {
+                Uint32 expected = (x < 320) ? screen.pixels[y * 320 + x] : 0xDEADBEEF;
+                if (padded[y * 330 + x] != expected) same = false;
+            }
+        }
+    }
+    check("C interface draws the same as the C++ functions", same);
+
+    rast_destroy(ctx);
+    rast_destroy(NULL);
+    rast_shutdown();
+    destroyOffscreen(screen);
+}
+
+int main() {
+    testFillBaseline();
+    testScissorStencil();
+    testStripsAndFans();
+    testFillPath();
+    testTriangulation();
+    testConservative();
+    testMaskCoverage();
+    testVisibilityShading();
+    testRetained();
+    testPicking();
+    testOcclusionNoFalseCulls();
+    testFrustumCulling();
+    testInstancing();
+    testLOD();
+    testRenderTiled();
+    testPackedMesh();
+    testHDRFormats();
+    testLinearColor();
+    testDitherExtremes();
+    testKernelSets();
+    testCInterface();
+
+    if (failures > 0) {
+        cout << failures << " check(s) failed" << endl;
+        return 1;
+    }
+    cout << "All checks passed" << endl;
+    return 0;
+}